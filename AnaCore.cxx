@@ -0,0 +1,267 @@
+////////////////////////////////////////////////////////////////////////
+// File:        AnaCore.cxx
+////////////////////////////////////////////////////////////////////////
+#include "AnaCore.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+test::AnaCore::AnaCore(AnaCoreConfig const & config)
+  : fConfig(config)
+  , fKernels(&GetCaloKernels(config.simd))
+{
+  if(fConfig.nPlanes < 1) throw std::runtime_error("AnaCore: nPlanes must be at least 1");
+  TrackChargeConfig const & charge = fConfig.charge;
+  if(!(charge.truncLow >= 0. && charge.truncLow < charge.truncHigh && charge.truncHigh <= 1.)){
+    throw std::runtime_error("AnaCore: the truncated mean range must satisfy 0 <= low < high <= 1");
+  }
+  if(!(charge.quantile > 0. && charge.quantile < 1.)) throw std::runtime_error("AnaCore: the quantile must be in (0, 1)");
+  if(!fConfig.columnar){
+    for(RecordField f : { kRecordPointdQdx, kRecordPointPlane, kRecordTrackHitOffset, kRecordTrackPointOffset }){
+      fConfig.fill.fields.reset(f);
+    }
+  }
+  for(int plane = 0; plane < fConfig.nPlanes; plane++){
+    RecordMask const & fill = fConfig.fill;
+    fSummaryPlanes.push_back(fill.Plane(kRecordPlaneTruncMeandQdx, plane) || fill.Plane(kRecordPlaneMediandQdx, plane)
+                             || fill.Plane(kRecordPlaneQuantiledQdx, plane));
+  }
+  if(fConfig.nPlanes == 2) fProcessTrack = &AnaCore::ProcessTrackN<2>;
+  else if(fConfig.nPlanes == 3) fProcessTrack = &AnaCore::ProcessTrackN<3>;
+  else fProcessTrack = &AnaCore::ProcessTrackN<0>;
+}
+
+void test::AnaCore::ConfigureAccumulators(AnaAccumulators & acc, int nbins, double xmin, double xmax) const
+{
+  acc.dQdx.Reset(nbins, xmin, xmax);
+  acc.planedQdx.resize(fConfig.nPlanes);
+  for(HistPartial & hist : acc.planedQdx) hist.Reset(nbins, xmin, xmax);
+}
+
+bool test::AnaCore::UsesHits() const
+{
+  RecordMask const & fill = fConfig.fill;
+  return fill.Field(kRecordView) || fill.Field(kRecordPeakTime) || fill.Field(kRecordHitIntegral)
+    || (fConfig.gains && UsesCalorimetry());
+}
+
+bool test::AnaCore::UsesCalorimetry() const
+{
+  RecordMask const & fill = fConfig.fill;
+  return fill.Field(kRecordX) || fill.Field(kRecordY) || fill.Field(kRecordZ)
+    || fill.Field(kRecordPlanenum) || fill.Field(kRecordPointdQdx) || fill.Field(kRecordPointPlane)
+    || fill.Field(kRecordTrackPointOffset) || fConfig.histograms
+    || fill.AnyPlane(kRecordPlanedQdx) || fill.AnyPlane(kRecordPlaneTruncMeandQdx)
+    || fill.AnyPlane(kRecordPlaneMediandQdx) || fill.AnyPlane(kRecordPlaneQuantiledQdx);
+}
+
+void test::AnaCore::SelectPrimaryMuons(Span<PFParticleView> pfps, std::vector<std::size_t> & selected) const
+{
+  selected.clear();
+  for(std::size_t i = 0; i < pfps.size; i++){
+    if(IsPrimaryMuon(pfps[i])) selected.push_back(i);
+  }
+}
+
+void test::AnaCore::BeginEvent(EventRecord & rec, unsigned int eventID) const
+{
+  rec.Clear();
+  rec.SetNPlanes(fConfig.nPlanes);
+  rec.eventID = eventID;
+  if(fConfig.fill.Field(kRecordTrackHitOffset)) rec.TrackHitOffset.push_back(0);
+  if(fConfig.fill.Field(kRecordTrackPointOffset)) rec.TrackPointOffset.push_back(0);
+}
+
+template <int NPlanes>
+void test::AnaCore::ProcessTrackN(TrackView const & track, EventRecord & rec, AnaAccumulators & acc) const
+{
+  unsigned int const nPlanes = NPlanes > 0 ? NPlanes : fConfig.nPlanes;
+  RecordMask const & fill = fConfig.fill;
+  rec.nTracks++;
+
+  Span<HitView> const & hits = track.hits;
+  if(track.firstValidPoint >= hits.size) return;
+  double const startTick = hits[track.firstValidPoint].peakTime;
+  if(!(startTick > fConfig.startTickCut)) return;
+
+  // Only the enabled entries are filled; the loops of a disabled group are skipped
+  if(fill.Field(kRecordTrackLength)) rec.TrackLength.push_back(track.length);
+  if(fill.Field(kRecordnHits)) rec.nHits.push_back(track.nHits);
+  if(fill.Field(kRecordStartTick)) rec.StartTick.push_back(startTick);
+  if(fill.Field(kRecordView)) for(HitView const & hit : hits) rec.View.push_back(hit.plane);
+  if(fill.Field(kRecordPeakTime)) for(HitView const & hit : hits) rec.PeakTime.push_back(hit.peakTime);
+  if(fill.Field(kRecordHitIntegral)) for(HitView const & hit : hits) rec.HitIntegral.push_back(hit.integral);
+
+  if(fill.Field(kRecordStartX)) rec.StartX.push_back(track.start[0]);
+  if(fill.Field(kRecordStartY)) rec.StartY.push_back(track.start[1]);
+  if(fill.Field(kRecordStartZ)) rec.StartZ.push_back(track.start[2]);
+  if(fill.Field(kRecordEndX)) rec.EndX.push_back(track.end[0]);
+  if(fill.Field(kRecordEndY)) rec.EndY.push_back(track.end[1]);
+  if(fill.Field(kRecordEndZ)) rec.EndZ.push_back(track.end[2]);
+
+  bool const fillX = fill.Field(kRecordX), fillY = fill.Field(kRecordY), fillZ = fill.Field(kRecordZ);
+  bool const anySummary = std::find(fSummaryPlanes.begin(), fSummaryPlanes.end(), true) != fSummaryPlanes.end();
+  // Stopping muons: dQ/dx versus residual range of the tracks ending inside
+  bool const stopping = acc.stopping.Enabled() && acc.stopping.TagTrack(track.end);
+  bool const needCharge = fill.Field(kRecordPointdQdx) || fill.AnyPlane(kRecordPlanedQdx) || anySummary
+    || fConfig.histograms || acc.lifetime.Enabled() || stopping || acc.chargeFits.Enabled()
+    || acc.voxels.Enabled();
+  AnaAccumulators::Scratch & scratch = acc.scratch;
+  if(anySummary){
+    scratch.planeCharge.resize(nPlanes);
+    scratch.planeQuantile.resize(nPlanes);
+    for(unsigned int plane = 0; plane < nPlanes; plane++){
+      scratch.planeCharge[plane].clear();
+      scratch.planeQuantile[plane].Reset(fConfig.charge.quantile);
+    }
+  }
+  if(needCharge && fConfig.gains) ResolveHitGains(track, scratch);
+  std::size_t nPoints = 0;
+  for(CaloView const & cal : track.calos){
+    if(!cal.valid) continue;
+    nPoints += cal.n;
+    if(fill.Field(kRecordPlanenum)) rec.Planenum.push_back(cal.plane);
+    if(fillX && fillY && fillZ){
+      std::size_t const first = rec.X.size();
+      rec.X.resize(first + cal.n); rec.Y.resize(first + cal.n); rec.Z.resize(first + cal.n);
+      fKernels->deinterleave(cal.xyz, cal.n, rec.X.data() + first, rec.Y.data() + first, rec.Z.data() + first);
+    }
+    else if(fillX || fillY || fillZ){
+      std::vector<double> & xyz = acc.scratch.xyz;
+      xyz.resize(3 * cal.n);
+      double * x = xyz.data(), * y = x + cal.n, * z = y + cal.n;
+      fKernels->deinterleave(cal.xyz, cal.n, x, y, z);
+      if(fillX) rec.X.insert(rec.X.end(), x, x + cal.n);
+      if(fillY) rec.Y.insert(rec.Y.end(), y, y + cal.n);
+      if(fillZ) rec.Z.insert(rec.Z.end(), z, z + cal.n);
+    }
+    if(fill.Field(kRecordPointPlane)) rec.PointPlane.insert(rec.PointPlane.end(), cal.n, cal.plane);
+    if(!needCharge) continue;
+
+    float const * dQdx = ScaleCharge(track, cal, acc.scratch);
+    if(fill.Field(kRecordPointdQdx)) rec.PointdQdx.insert(rec.PointdQdx.end(), dQdx, dQdx + cal.n);
+    if(acc.lifetime.Enabled()) FillLifetime(track, cal, dQdx, acc.lifetime);
+    if(acc.chargeFits.Enabled()) FillChargeFits(track, cal, dQdx, acc.chargeFits);
+    if(acc.voxels.Enabled()) acc.voxels.AddPoints(cal.plane, cal.xyz, dQdx, cal.n);
+    if(stopping && cal.resRange && cal.pitch){
+      for(std::size_t i = 0; i < cal.n; i++) acc.stopping.Add(cal.plane, cal.resRange[i], cal.pitch[i], dQdx[i]);
+    }
+    // One plane per calorimetry object: the plane is picked once here, and
+    // the per-plane histogram shares the binning of the combined one
+    unsigned int const plane = cal.plane;
+    if(plane >= nPlanes) continue;
+    if(fill.Plane(kRecordPlanedQdx, plane)){
+      ArenaColumn< float > & planeColumn = rec.PlanedQdx[plane];
+      planeColumn.insert(planeColumn.end(), dQdx, dQdx + cal.n);
+    }
+    if(fill.Plane(kRecordPlaneTruncMeandQdx, plane) || fill.Plane(kRecordPlaneMediandQdx, plane)){
+      scratch.planeCharge[plane].insert(scratch.planeCharge[plane].end(), dQdx, dQdx + cal.n);
+    }
+    if(fill.Plane(kRecordPlaneQuantiledQdx, plane)){
+      P2Quantile & p2 = scratch.planeQuantile[plane];
+      for(std::size_t i = 0; i < cal.n; i++) p2.Add(dQdx[i]);
+    }
+    if(!fConfig.histograms) continue;
+    HistPartial & hist = acc.dQdx;
+    acc.scratch.bins.resize(cal.n);
+    int * bins = acc.scratch.bins.data();
+    fKernels->binIndices(dQdx, cal.n, hist.xmin, hist.xmax, hist.nbins, bins);
+    hist.FillBins(bins, cal.n);
+    acc.planedQdx[plane].FillBins(bins, cal.n);
+  }
+
+  // One summary per track and plane, aligned with the track columns
+  for(unsigned int plane = 0; plane < nPlanes; plane++){
+    if(!fSummaryPlanes[plane]) continue;
+    TrackChargeSummary const summary = SummarizeCharge(scratch.planeCharge[plane], scratch.planeQuantile[plane], fConfig.charge);
+    if(fill.Plane(kRecordPlaneTruncMeandQdx, plane)) rec.PlaneTruncMeandQdx[plane].push_back(summary.truncatedMean);
+    if(fill.Plane(kRecordPlaneMediandQdx, plane)) rec.PlaneMediandQdx[plane].push_back(summary.median);
+    if(fill.Plane(kRecordPlaneQuantiledQdx, plane)) rec.PlaneQuantiledQdx[plane].push_back(summary.quantile);
+  }
+
+  // Offsets from the counts, so they hold even when the columns they index are off
+  if(fill.Field(kRecordTrackHitOffset)) rec.TrackHitOffset.push_back(rec.TrackHitOffset.back() + track.nHits);
+  if(fill.Field(kRecordTrackPointOffset)) rec.TrackPointOffset.push_back(rec.TrackPointOffset.back() + nPoints);
+}
+
+void test::AnaCore::AppendPartial(EventRecord const & part, EventRecord & rec) const
+{
+  rec.nTracks += part.nTracks;
+  EventRecord::ForEachColumn([](RecordField f, auto & to, auto const & from){
+      if(f != kRecordTrackHitOffset && f != kRecordTrackPointOffset){
+        to.insert(to.end(), from.begin(), from.end());
+        return;
+      }
+      // Offsets of a partial start from its own 0
+      if(from.empty()) return;
+      auto const base = to.back();
+      for(std::size_t i = 1; i < from.size(); i++) to.push_back(base + from[i]);
+    }, rec, part);
+  EventRecord::ForEachPlaneColumn([](RecordPlaneField, std::size_t, auto & to, auto const & from){
+      to.insert(to.end(), from.begin(), from.end());
+    }, rec, part);
+}
+
+void test::AnaCore::ResolveHitGains(TrackView const & track, AnaAccumulators::Scratch & scratch) const
+{
+  // The points index the hits: the table is read once per hit instead of
+  // once per point and plane, and the points then gather plain floats
+  GainTable const & gains = *fConfig.gains;
+  std::size_t const nHits = track.hits.size;
+  scratch.hitGain.resize(nHits + 1);
+  float * gain = scratch.hitGain.data();
+  for(std::size_t h = 0; h < nHits; h++) gain[h] = gains.Gain(track.hits[h].channel);
+  gain[nHits] = gains.DefaultGain(); // points without a hit
+}
+
+float const * test::AnaCore::ScaleCharge(TrackView const & track, CaloView const & cal, AnaAccumulators::Scratch & scratch) const
+{
+  std::size_t const n = cal.n;
+  scratch.dQdx.resize(n);
+  float * out = scratch.dQdx.data();
+  float const * in = cal.dQdx;
+
+  GainTable const * gains = fConfig.gains;
+  if(!gains){
+    fKernels->divide(in, nullptr, fConfig.calibConstant, out, n); // C = 89.1 [ADC/fC]
+    return out;
+  }
+
+  // Points without trajectory point indices: the default gain for all of them
+  if(!cal.tpIndices){
+    fKernels->divide(in, nullptr, gains->DefaultGain(), out, n);
+    return out;
+  }
+  // One pass gathering the per-hit gains and dividing, without a per-point
+  // gain buffer in between
+  float const * hitGain = scratch.hitGain.data();
+  std::size_t const nHits = track.hits.size;
+  for(std::size_t i = 0; i < n; i++) out[i] = in[i] / hitGain[std::min(cal.tpIndices[i], nHits)];
+  return out;
+}
+
+void test::AnaCore::FillLifetime(TrackView const & track, CaloView const & cal, float const * dQdx, LifetimeAccumulator & lifetime) const
+{
+  LifetimeConfig const & cfg = lifetime.Config();
+  if(cfg.plane >= 0 && cal.plane != cfg.plane) return;
+  if(cfg.source == LifetimeConfig::kX){
+    for(std::size_t i = 0; i < cal.n; i++) lifetime.Add(lifetime.DriftTimeFromX(cal.xyz[3*i]), dQdx[i]);
+  }
+  else if(cal.tpIndices){
+    for(std::size_t i = 0; i < cal.n; i++){
+      std::size_t const tp = cal.tpIndices[i];
+      if(tp >= track.hits.size) continue;
+      lifetime.Add(lifetime.DriftTimeFromTick(track.hits[tp].peakTime), dQdx[i]);
+    }
+  }
+}
+
+void test::AnaCore::FillChargeFits(TrackView const & track, CaloView const & cal, float const * dQdx, ChargeFitAccumulator & fits) const
+{
+  bool const channels = fits.UsesChannels() && cal.tpIndices;
+  for(std::size_t i = 0; i < cal.n; i++){
+    unsigned int channel = ChargeFitAccumulator::kNoChannel;
+    if(channels && cal.tpIndices[i] < track.hits.size) channel = track.hits[cal.tpIndices[i]].channel;
+    fits.Add(cal.plane, cal.xyz[3*i], channel, dQdx[i]);
+  }
+}
@@ -0,0 +1,190 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       AnaCore
+// File:        AnaCore.h
+//
+// art-independent processing core of MyPDDPTestAna: primary muon
+// selection, hit and calorimetry extraction and dQ/dx scaling. It works
+// on lightweight, non-owning views of the reconstructed objects so it
+// can be driven by the art module or by synthetic events
+// (SyntheticEvents.h, AnaCoreBench.cc).
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_ANACORE_H
+#define MYPDDPTESTANA_ANACORE_H
+
+#include <cstddef>
+#include <vector>
+
+#include "CaloKernels.h"
+#include "ChargeFitAccumulator.h"
+#include "EventRecord.h"
+#include "GainTable.h"
+#include "LifetimeAccumulator.h"
+#include "StoppingMuonAccumulator.h"
+#include "TrackCharge.h"
+#include "VoxelChargeAccumulator.h"
+
+namespace test {
+
+  // Non-owning contiguous range
+  template <typename T>
+  struct Span {
+    T const * data = nullptr;
+    std::size_t size = 0;
+
+    Span() = default;
+    Span(T const * d, std::size_t n) : data(d), size(n) {}
+    Span(std::vector<T> const & v) : data(v.data()), size(v.size()) {}
+
+    T const & operator[](std::size_t i) const { return data[i]; }
+    T const * begin() const { return data; }
+    T const * end() const { return data + size; }
+    bool empty() const { return size == 0; }
+  };
+
+  struct PFParticleView {
+    bool isPrimary;
+    int pdg;
+  };
+
+  struct HitView {
+    float peakTime;   // [ticks]
+    float integral;   // [ADC]
+    int plane;
+    unsigned int channel;
+  };
+
+  // One calorimetry object: n points with dQ/dx [ADC/cm] and interleaved
+  // x, y, z positions [cm] (the memory layout of std::vector<geo::Point_t>).
+  // tpIndices, when not null, gives the trajectory point (= track hit index)
+  // of each point; resRange and pitch, when not null, the residual range
+  // and track pitch [cm] of each point.
+  struct CaloView {
+    bool valid;
+    int plane;
+    std::size_t n;
+    float const * dQdx;
+    double const * xyz;
+    std::size_t const * tpIndices;
+    float const * resRange;
+    float const * pitch;
+  };
+
+  struct TrackView {
+    double length;
+    double start[3];
+    double end[3];
+    std::size_t firstValidPoint; // trajectory point index, also the index in hits
+    std::size_t nHits;           // hits of the track
+    Span<HitView> hits;          // all nHits, or only up to firstValidPoint when AnaCore::UsesHits() is false
+    Span<CaloView> calos;
+  };
+
+  // Job-level quantities filled while processing tracks; one set per
+  // schedule, merged at the end of the job
+  struct AnaAccumulators {
+    HistPartial dQdx;                   // all planes below nPlanes
+    std::vector<HistPartial> planedQdx; // one per plane
+    LifetimeAccumulator lifetime;
+    StoppingMuonAccumulator stopping;
+    ChargeFitAccumulator chargeFits;
+    VoxelChargeAccumulator voxels;
+
+    // Per-point work buffers of the calorimetry object being processed
+    struct Scratch {
+      std::vector<float> dQdx;  // [fC/cm]
+      std::vector<float> hitGain; // [ADC/fC] of each hit of the track, then the default gain
+      std::vector<int> bins;    // dQ/dx histogram bins
+      std::vector<double> xyz;  // x, y, z columns when only some of them are filled
+      // Per plane, for the track charge summaries: dQ/dx of the track's points and its P2 quantile
+      std::vector< std::vector<float> > planeCharge;
+      std::vector<P2Quantile> planeQuantile;
+    } scratch;
+  };
+
+  struct AnaCoreConfig {
+    float calibConstant = 89.1;   // [ADC/fC], used when there is no gain table
+    GainTable const * gains = nullptr; // per-channel / per-CRP gains, not owned
+    double startTickCut = 100.;   // tracks must start after this tick
+    bool columnar = true;         // fill the per-point columns and per-track offsets
+    RecordMask fill;              // record entries filled, the rest is skipped (BranchSelection.h)
+    bool histograms = true;       // fill the dQ/dx histograms
+    TrackChargeConfig charge;     // per-track, per-plane dQ/dx summaries (TruncMeandQdx, MediandQdx, QuantiledQdx)
+    int nPlanes = 2;              // planes with their own dQ/dx column and histogram (2: dual phase, 3: single phase)
+    SimdLevel simd = SimdLevel::kAuto; // batch kernels, lowered to what the CPU supports
+  };
+
+  class AnaCore {
+  public:
+    explicit AnaCore(AnaCoreConfig const & config = AnaCoreConfig());
+
+    AnaCoreConfig const & Config() const { return fConfig; }
+    SimdLevel KernelLevel() const { return fKernels->level; }
+
+    // Whether ProcessTrack reads every hit of the track (hit columns, gain
+    // lookup); otherwise only the hit at the first valid point, for the
+    // start tick cut. Drift times from PeakTime (lifetime) also need them.
+    bool UsesHits() const;
+    // Whether ProcessTrack reads the calorimetry objects at all; the
+    // lifetime accumulator also needs them
+    bool UsesCalorimetry() const;
+    static bool IsPrimaryMuon(PFParticleView const & pfp)
+    {
+      return pfp.isPrimary && (pfp.pdg == 13 || pfp.pdg == -13);
+    }
+
+    // Indices of the primary muons in pfps, in order
+    void SelectPrimaryMuons(Span<PFParticleView> pfps, std::vector<std::size_t> & selected) const;
+
+    // Size the per-plane histograms to nPlanes, all with the given binning
+    void ConfigureAccumulators(AnaAccumulators & acc, int nbins, double xmin, double xmax) const;
+
+    // Reset the record for a new event
+    void BeginEvent(EventRecord & rec, unsigned int eventID) const;
+
+    // Count one track of a selected muon and, if it passes the start tick cut,
+    // append its hits, calorimetry points and scaled dQ/dx to the record and
+    // the accumulators
+    void ProcessTrack(TrackView const & track, EventRecord & rec, AnaAccumulators & acc) const
+    {
+      (this->*fProcessTrack)(track, rec, acc);
+    }
+
+    // Intra-event parallelism: tracks processed into their own partial
+    // records (each started with BeginEvent, then given to ProcessTrack
+    // with accumulators of its thread) may run concurrently. Appending the
+    // partials in track order gives the record ProcessTrack would have
+    // built serially; the accumulators only hold integer counts and
+    // integer (fixed-point) sums, so they merge to the same content in any
+    // order.
+    void AppendPartial(EventRecord const & part, EventRecord & rec) const;
+
+  private:
+    // NPlanes > 0 fixes the plane count at compile time (the 2- and 3-plane
+    // cases); 0 reads it from the configuration
+    template <int NPlanes>
+    void ProcessTrackN(TrackView const & track, EventRecord & rec, AnaAccumulators & acc) const;
+
+    // Gain of each hit of the track, once for all its calorimetry objects,
+    // in scratch.hitGain
+    void ResolveHitGains(TrackView const & track, AnaAccumulators::Scratch & scratch) const;
+
+    // dQ/dx of every point of cal in fC/cm, in scratch.dQdx: divided by the gain
+    // of the point's channel when there is a gain table (from scratch.hitGain),
+    // by calibConstant otherwise
+    float const * ScaleCharge(TrackView const & track, CaloView const & cal, AnaAccumulators::Scratch & scratch) const;
+
+    // Drift time of each point from its x position or from the peak time of its hit
+    void FillLifetime(TrackView const & track, CaloView const & cal, float const * dQdx, LifetimeAccumulator & lifetime) const;
+
+    // Drift time of each point from its x position, CRP from the channel of its hit
+    void FillChargeFits(TrackView const & track, CaloView const & cal, float const * dQdx, ChargeFitAccumulator & fits) const;
+
+    AnaCoreConfig fConfig;
+    std::vector<bool> fSummaryPlanes; // planes with a track charge summary column filled
+    CaloKernels const * fKernels;
+    void (AnaCore::* fProcessTrack)(TrackView const &, EventRecord &, AnaAccumulators &) const;
+  };
+
+}
+
+#endif
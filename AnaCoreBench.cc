@@ -0,0 +1,398 @@
+////////////////////////////////////////////////////////////////////////
+// File:        AnaCoreBench.cc
+//
+// Microbenchmark of the MyPDDPTestAna processing core on synthetic
+// events: selection, hit/calorimetry extraction and dQ/dx scaling, with
+// the same per-event flow as the art module. Needs no art or ROOT:
+//
+//   g++ -O2 -std=c++17 -o AnaCoreBench AnaCoreBench.cc AnaCore.cxx CaloKernels.cxx
+//       GainTable.cxx LifetimeAccumulator.cxx RecordArena.cxx SyntheticEvents.cxx
+//       BranchSelection.cxx ChargeFitAccumulator.cxx LangausFit.cxx StoppingMuonAccumulator.cxx
+//       TrackCharge.cxx VoxelChargeAccumulator.cxx -ltbb
+//   ./AnaCoreBench events=2000 pfps=300 muons=0.2 hits=600 planes=2 lifetime=1 stopping=1 fits=1 voxels=5 gains=1 simd=avx2
+//   ./AnaCoreBench branches=calo.dQdx*,track.StartTick,hist.*
+//   ./AnaCoreBench branches=track.*,charge.*
+//   ./AnaCoreBench pfps=3000 parallel=32
+//
+// parallel=N runs the tracks of events with at least N of them as TBB
+// tasks into per-track partial records, as ParallelTrackThreshold does in
+// the module, and checks the record against the serial one.
+//
+// After the event loop, each batch kernel is timed alone at every SIMD
+// level the CPU supports, over the calorimetry points of one event.
+////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "tbb/enumerable_thread_specific.h"
+#include "tbb/parallel_for.h"
+
+#include "AnaCore.h"
+#include "BranchSelection.h"
+#include "RecordArena.h"
+#include "SyntheticEvents.h"
+
+namespace {
+
+  // key=value command line arguments
+  double Arg(int argc, char ** argv, const char * key, double def)
+  {
+    std::size_t const len = std::strlen(key);
+    for(int i = 1; i < argc; i++){
+      if(!std::strncmp(argv[i], key, len) && argv[i][len] == '=') return std::atof(argv[i] + len + 1);
+    }
+    return def;
+  }
+
+  std::string ArgString(int argc, char ** argv, const char * key, std::string const & def)
+  {
+    std::size_t const len = std::strlen(key);
+    for(int i = 1; i < argc; i++){
+      if(!std::strncmp(argv[i], key, len) && argv[i][len] == '=') return argv[i] + len + 1;
+    }
+    return def;
+  }
+
+  // ns per point of each kernel at one level, repeated over the calorimetry
+  // objects of one event so that the data stay in cache
+  void BenchKernels(test::SimdLevel level, test::SyntheticEvent const & event)
+  {
+    test::CaloKernels const & k = test::GetCaloKernels(level);
+    std::size_t maxPoints = 0;
+    for(std::vector<float> const & q : event.dQdx) maxPoints = std::max(maxPoints, q.size());
+    std::vector<float> scaled(maxPoints), gain(maxPoints, 89.1f);
+    std::vector<int> bins(maxPoints);
+    std::vector<double> x(maxPoints), y(maxPoints), z(maxPoints);
+    int const nRepeat = 200;
+    double const points = double(event.NPoints()) * nRepeat;
+
+    auto time = [&](auto && kernel){
+      auto const t0 = std::chrono::steady_clock::now();
+      for(int r = 0; r < nRepeat; r++){
+        for(std::size_t ic = 0; ic < event.dQdx.size(); ic++) kernel(ic, event.dQdx[ic].size());
+      }
+      return 1e9 * std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() / points;
+    };
+    double const divide = time([&](std::size_t ic, std::size_t n){ k.divide(event.dQdx[ic].data(), nullptr, 89.1f, scaled.data(), n); });
+    double const divideGains = time([&](std::size_t ic, std::size_t n){ k.divide(event.dQdx[ic].data(), gain.data(), 0.f, scaled.data(), n); });
+    double const binIndices = time([&](std::size_t ic, std::size_t n){ k.binIndices(event.dQdx[ic].data(), n, 0., 4000., 50, bins.data()); });
+    double const deinterleave = time([&](std::size_t ic, std::size_t n){ k.deinterleave(event.xyz[ic].data(), n, x.data(), y.data(), z.data()); });
+    std::printf("  %-7s divide %.3f, divide by gains %.3f, bin indices %.3f, deinterleave %.3f ns/point\n",
+                test::SimdLevelName(k.level), divide, divideGains, binIndices, deinterleave);
+  }
+
+  // Parallel track path of the module (ParallelTrackThreshold)
+  struct ParallelTracks {
+    std::size_t threshold = 0; // 0: serial
+    std::vector<test::TrackView const *> tracks;
+    std::vector<test::EventRecord> partials;
+    tbb::enumerable_thread_specific<test::AnaAccumulators> accumulators;
+
+    explicit ParallelTracks(test::AnaAccumulators const & exemplar) : accumulators(exemplar) {}
+  };
+
+  // Same flow as MyPDDPTestAna::analyze in selection-first mode
+  void ProcessEvent(test::AnaCore const & core, test::SyntheticEvent const & event, test::RecordArena & arena,
+                    test::EventRecord & rec, test::AnaAccumulators & acc, std::vector<std::size_t> & muons,
+                    ParallelTracks & parallel)
+  {
+    arena.BeginEvent(rec);
+    core.BeginEvent(rec, event.eventID);
+    rec.nPFParticles = event.pfps.size();
+    core.SelectPrimaryMuons(test::Span<test::PFParticleView>(event.pfps), muons);
+    rec.nPrimaries = muons.size();
+
+    // Expected sizes from the selected tracks, as the module does from the associations
+    test::RecordSizes expected;
+    for(std::size_t imuon : muons){
+      for(std::size_t itrk : event.pfpTracks[imuon]){
+        test::TrackView const & track = event.tracks[itrk];
+        expected.tracks++;
+        expected.hits += track.hits.size;
+        expected.calos += track.calos.size;
+        for(test::CaloView const & cal : track.calos) expected.points += cal.n;
+      }
+    }
+    arena.Reserve(rec, expected, core.Config().fill);
+
+    std::vector<test::TrackView const *> & tracks = parallel.tracks;
+    tracks.clear();
+    for(std::size_t imuon : muons){
+      for(std::size_t itrk : event.pfpTracks[imuon]) tracks.push_back(&event.tracks[itrk]);
+    }
+    if(parallel.threshold == 0 || tracks.size() < parallel.threshold){
+      for(test::TrackView const * track : tracks) core.ProcessTrack(*track, rec, acc);
+    }
+    else{
+      if(parallel.partials.size() < tracks.size()) parallel.partials.resize(tracks.size());
+      tbb::parallel_for(std::size_t(0), tracks.size(), [&](std::size_t i){
+          core.BeginEvent(parallel.partials[i], 0);
+          core.ProcessTrack(*tracks[i], parallel.partials[i], parallel.accumulators.local());
+        });
+      for(std::size_t i = 0; i < tracks.size(); i++) core.AppendPartial(parallel.partials[i], rec);
+    }
+    arena.EndEvent(rec);
+  }
+
+  // Same scalars and columns, bit for bit
+  bool SameRecord(test::EventRecord const & a, test::EventRecord const & b)
+  {
+    bool same = a.NPlanes() == b.NPlanes();
+    test::EventRecord::ForEachScalar([&same](test::RecordField, auto const & x, auto const & y){ same = same && x == y; }, a, b);
+    test::EventRecord::ForEachColumn([&same](test::RecordField, auto const & x, auto const & y){
+        same = same && x.size() == y.size() && std::memcmp(x.data(), y.data(), x.size() * sizeof(x[0])) == 0;
+      }, a, b);
+    if(same) test::EventRecord::ForEachPlaneColumn([&same](test::RecordPlaneField, std::size_t, auto const & x, auto const & y){
+        same = same && x.size() == y.size() && std::memcmp(x.data(), y.data(), x.size() * sizeof(x[0])) == 0;
+      }, a, b);
+    return same;
+  }
+
+}
+
+int main(int argc, char ** argv)
+{
+  test::SyntheticConfig cfg;
+  cfg.nPFParticles        = Arg(argc, argv, "pfps", cfg.nPFParticles);
+  cfg.primaryMuonFraction = Arg(argc, argv, "muons", cfg.primaryMuonFraction);
+  cfg.tracksPerMuon       = Arg(argc, argv, "tracks", cfg.tracksPerMuon);
+  cfg.hitsPerTrack        = Arg(argc, argv, "hits", cfg.hitsPerTrack);
+  cfg.nPlanes             = Arg(argc, argv, "planes", cfg.nPlanes);
+  cfg.seed                = Arg(argc, argv, "seed", cfg.seed);
+  std::size_t const nEvents = Arg(argc, argv, "events", 1000);
+  std::size_t const nDistinct = Arg(argc, argv, "distinct", 32); // events generated, then cycled
+
+  test::SyntheticEventGenerator generator(cfg);
+  std::vector<test::SyntheticEvent> events(nDistinct);
+  std::size_t nTracks = 0, nPoints = 0;
+  for(test::SyntheticEvent & event : events){
+    generator.Generate(event);
+    nTracks += event.tracks.size();
+    nPoints += event.NPoints();
+  }
+
+  // gains=1: per-channel gain table (mapped from a scratch file) instead of the constant
+  test::AnaCoreConfig coreConfig;
+  coreConfig.simd = test::ParseSimdLevel(ArgString(argc, argv, "simd", "auto"));
+  coreConfig.nPlanes = cfg.nPlanes;
+  // branches=p1,p2,...: output selection patterns (BranchSelection.h), default all
+  test::BranchSelection selection(cfg.nPlanes);
+  std::vector<std::string> patterns;
+  std::string const branches = ArgString(argc, argv, "branches", "*");
+  for(std::size_t begin = 0, end; begin <= branches.size(); begin = end + 1){
+    end = std::min(branches.find(',', begin), branches.size());
+    patterns.push_back(branches.substr(begin, end - begin));
+  }
+  selection.Apply(patterns, cfg.nPlanes);
+  coreConfig.fill = selection.mask;
+  coreConfig.histograms = selection.histograms;
+  std::unique_ptr<test::GainTable> gains;
+  if(Arg(argc, argv, "gains", 0) != 0){
+    std::vector<float> table(960 * cfg.nPlanes);
+    for(std::size_t ch = 0; ch < table.size(); ch++) table[ch] = 89.1f * (0.9f + 0.2f * (ch % 17) / 16.f);
+    std::string const path = "AnaCoreBench_gains.bin";
+    test::GainTable::Write(path, 1, table, 89.1f);
+    gains = std::make_unique<test::GainTable>(path);
+    std::remove(path.c_str()); // the mapping stays valid
+    coreConfig.gains = gains.get();
+  }
+  test::AnaCore core(coreConfig);
+  test::RecordArena arena(Arg(argc, argv, "arena", 1 << 16)); // initial bytes, small so that it regrows
+  test::EventRecord rec; // after the arena, which must outlive it
+  test::AnaAccumulators acc;
+  // hbins=, hmin=, hmax=: binning of the hdQdx partials [fC/cm]
+  core.ConfigureAccumulators(acc, Arg(argc, argv, "hbins", 50), Arg(argc, argv, "hmin", 0.), Arg(argc, argv, "hmax", 50.));
+  test::LifetimeConfig lifetime;
+  lifetime.enable = Arg(argc, argv, "lifetime", 0) != 0;
+  acc.lifetime.Configure(lifetime);
+  // stopping=1: dQ/dx versus residual range of the tracks ending inside the
+  // generated volume (all of them; the synthetic points are sparse, so the
+  // pitch cut is opened)
+  test::StoppingMuonConfig stopping;
+  stopping.enable = Arg(argc, argv, "stopping", 0) != 0;
+  stopping.nPlanes = cfg.nPlanes;
+  stopping.xMin = cfg.anodeX - 600.;
+  stopping.xMax = cfg.anodeX;
+  stopping.maxPitch = 20.;
+  acc.stopping.Configure(stopping);
+  // fits=1: dQ/dx histograms per plane, CRP (480 synthetic channels each)
+  // and drift slice, Landau-Gaussian fits in parallel after the event loop
+  test::ChargeFitConfig chargeFits;
+  chargeFits.enable = Arg(argc, argv, "fits", 0) != 0;
+  chargeFits.sets = { "plane", "crp:plane", "drift:plane", "drift:crp:plane" };
+  chargeFits.nPlanes = cfg.nPlanes;
+  chargeFits.channelsPerCRP = 480;
+  chargeFits.nDriftSlices = Arg(argc, argv, "slices", 100);
+  chargeFits.tMax = 600. / cfg.driftVelocity;
+  chargeFits.qMax = 5.;
+  acc.chargeFits.Configure(chargeFits);
+  // voxels=<size>: sparse map of the points' dQ/dx in cubic voxels of that size [cm]
+  test::VoxelChargeConfig voxels;
+  voxels.enable = Arg(argc, argv, "voxels", 0) > 0;
+  voxels.nPlanes = cfg.nPlanes;
+  if(voxels.enable) for(double & size : voxels.size) size = Arg(argc, argv, "voxels", 0);
+  acc.voxels.Configure(voxels);
+  std::vector<std::size_t> muons;
+  ParallelTracks parallel(acc);
+  parallel.threshold = Arg(argc, argv, "parallel", 0);
+
+  // Warm-up: grows the record arena to its steady-state size
+  for(test::SyntheticEvent const & event : events) ProcessEvent(core, event, arena, rec, acc, muons, parallel);
+  unsigned long const warmupAllocations = arena.TotalAllocations();
+  unsigned long const warmupEvents = arena.Events();
+
+  auto const t0 = std::chrono::steady_clock::now();
+  for(std::size_t i = 0; i < nEvents; i++) ProcessEvent(core, events[i % nDistinct], arena, rec, acc, muons, parallel);
+  double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  double const tracksPerEvent = double(nTracks) / nDistinct;
+  double const pointsPerEvent = double(nPoints) / nDistinct;
+  double const nsPerEvent = 1e9 * seconds / nEvents;
+  std::printf("kernels: %s\n", test::SimdLevelName(core.KernelLevel()));
+  std::printf("events %zu, %.1f tracks/event, %.0f calorimetry points/event\n", nEvents, tracksPerEvent, pointsPerEvent);
+  std::printf("%.3f us/event, %.1f ns/track, %.2f ns/point, %.0f events/s\n",
+              nsPerEvent / 1e3, tracksPerEvent > 0 ? nsPerEvent / tracksPerEvent : 0.,
+              pointsPerEvent > 0 ? nsPerEvent / pointsPerEvent : 0., nEvents / seconds);
+  std::printf("record arena: %zu bytes after %lu regrowths; allocations %lu in %lu warm-up events, %lu in %lu timed events\n",
+              arena.BufferBytes(), arena.Regrowths(), warmupAllocations, warmupEvents,
+              arena.TotalAllocations() - warmupAllocations, arena.Events() - warmupEvents);
+  // The per-thread accumulators of the parallel tasks hold integer counts
+  // and sums: merged in any order they give the serial histograms
+  for(test::AnaAccumulators const & part : parallel.accumulators){
+    acc.dQdx.Merge(part.dQdx);
+    for(std::size_t plane = 0; plane < acc.planedQdx.size(); plane++) acc.planedQdx[plane].Merge(part.planedQdx[plane]);
+    acc.lifetime.Merge(part.lifetime);
+    acc.stopping.Merge(part.stopping);
+    acc.chargeFits.Merge(part.chargeFits);
+    acc.voxels.Merge(part.voxels);
+  }
+  std::printf("histogram checksum %lu", acc.dQdx.Entries());
+  for(test::HistPartial const & hist : acc.planedQdx) std::printf(", %lu", hist.Entries());
+  std::printf("\n");
+  if(acc.lifetime.Enabled()){
+    test::LifetimeFit const fit = acc.lifetime.Fit(acc.lifetime.Bins());
+    std::printf("lifetime %.0f +- %.0f us (generated %.0f us), chi2/ndf %.1f/%d\n",
+                fit.tau, fit.tauError, cfg.lifetime, fit.chi2, fit.ndf);
+  }
+  if(acc.stopping.Enabled()){
+    std::vector<test::StoppingMuonBin> const bins = acc.stopping.FitBragg();
+    int valid = 0;
+    double mpv = 0.;
+    for(test::StoppingMuonBin const & bin : bins){
+      if(!bin.valid) continue;
+      valid++;
+      mpv += bin.mpv;
+    }
+    std::printf("stopping muons: %lu tracks, %zu populated bins, %d of %zu Bragg bins fitted, mean MPV %.2f fC/cm\n",
+                acc.stopping.StoppingTracks(), acc.stopping.PopulatedBins(), valid, bins.size(), valid ? mpv / valid : 0.);
+  }
+  if(acc.voxels.Enabled()){
+    unsigned long points = 0;
+    acc.voxels.ForEachVoxel([&points](int, int const *, test::VoxelCharge const & voxel){ points += voxel.count; });
+    std::printf("voxel charge: %zu populated voxels of %g cm, %lu points (%.1f per voxel), %lu skipped\n",
+                acc.voxels.PopulatedVoxels(), voxels.size[0], points,
+                acc.voxels.PopulatedVoxels() ? double(points) / acc.voxels.PopulatedVoxels() : 0., acc.voxels.SkippedPoints());
+  }
+  if(acc.chargeFits.Enabled()){
+    // One task per histogram, as in the module's endJob
+    std::vector< std::pair<std::size_t, int> > jobs;
+    std::vector<test::ChargeFitAccumulator::Set> const & sets = acc.chargeFits.Sets();
+    for(std::size_t s = 0; s < sets.size(); s++){
+      for(int h = 0; h < sets[s].nHistograms; h++) jobs.emplace_back(s, h);
+    }
+    std::vector<test::LangausFitResult> results(jobs.size());
+    test::LangausFitConfig const fitConfig;
+    auto const f0 = std::chrono::steady_clock::now();
+    tbb::parallel_for(std::size_t(0), jobs.size(), [&](std::size_t j){
+        results[j] = acc.chargeFits.Fit(sets[jobs[j].first], jobs[j].second, fitConfig);
+      });
+    double const fitSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - f0).count();
+    int valid = 0;
+    for(test::LangausFitResult const & r : results) valid += r.valid;
+    std::printf("charge fits: %d of %zu histograms fitted in %.2f s; plane 0 MPV %.4f +- %.4f fC/cm, chi2/ndf %.1f/%d\n",
+                valid, results.size(), fitSeconds, results[0].mpv, results[0].mpvError, results[0].chi2, results[0].ndf);
+  }
+
+  if(parallel.threshold > 0){
+    // One event through both paths, each on its own arena
+    test::RecordArena serialArena, parallelArena;
+    test::EventRecord serialRec, parallelRec;
+    test::AnaAccumulators scratchAcc = acc;
+    ParallelTracks serial(acc), forced(acc);
+    forced.threshold = 1;
+    ProcessEvent(core, events[0], serialArena, serialRec, scratchAcc, muons, serial);
+    ProcessEvent(core, events[0], parallelArena, parallelRec, scratchAcc, muons, forced);
+    std::printf("parallel tracks from %zu per event: record of %zu tracks %s the serial one\n", parallel.threshold,
+                events[0].tracks.size(), SameRecord(serialRec, parallelRec) ? "identical to" : "DIFFERS from");
+    if(acc.voxels.Enabled()){
+      // Voxel sums of the event from the per-thread partials, merged in
+      // their (scheduling-dependent) order, against the serial ones
+      test::AnaAccumulators serialAcc = acc, mergedAcc = acc;
+      serialAcc.voxels.Configure(voxels);
+      mergedAcc.voxels.Configure(voxels);
+      test::AnaAccumulators empty = acc;
+      empty.voxels.Configure(voxels);
+      ParallelTracks serialVoxels(empty), forcedVoxels(empty);
+      forcedVoxels.threshold = 1;
+      test::RecordArena voxelArena;
+      test::EventRecord voxelRec;
+      ProcessEvent(core, events[0], voxelArena, voxelRec, serialAcc, muons, serialVoxels);
+      ProcessEvent(core, events[0], voxelArena, voxelRec, empty, muons, forcedVoxels);
+      mergedAcc.voxels.Merge(empty.voxels);
+      for(test::AnaAccumulators const & part : forcedVoxels.accumulators) mergedAcc.voxels.Merge(part.voxels);
+      using Voxel = std::tuple<int, int, int, int, unsigned long, long long, unsigned long long>;
+      auto const dump = [](test::VoxelChargeAccumulator const & map){
+        std::vector<Voxel> out;
+        map.ForEachVoxel([&out](int plane, int const * i, test::VoxelCharge const & v){
+            out.emplace_back(plane, i[0], i[1], i[2], v.count, v.sum, v.sum2);
+          });
+        return out;
+      };
+      std::printf("parallel tracks: voxel map of %zu voxels %s the serial one\n", mergedAcc.voxels.PopulatedVoxels(),
+                  dump(serialAcc.voxels) == dump(mergedAcc.voxels) ? "identical to" : "DIFFERS from");
+    }
+  }
+
+  {
+    // The P2 quantile columns alone, without the median and truncated mean
+    // that collect the point values: same quantiles as with all of them
+    auto const charge = [&](std::vector<std::string> const & chargePatterns, test::RecordArena & chargeArena, test::EventRecord & chargeRec){
+      test::BranchSelection chargeSelection(cfg.nPlanes);
+      chargeSelection.Apply(chargePatterns, cfg.nPlanes);
+      test::AnaCoreConfig chargeConfig = coreConfig;
+      chargeConfig.fill = chargeSelection.mask;
+      chargeConfig.histograms = false;
+      test::AnaCore chargeCore(chargeConfig);
+      test::AnaAccumulators chargeAcc = acc;
+      ParallelTracks serial(acc);
+      ProcessEvent(chargeCore, events[0], chargeArena, chargeRec, chargeAcc, muons, serial);
+    };
+    test::RecordArena allArena, quantileArena;
+    test::EventRecord allRec, quantileRec;
+    charge({ "charge.*" }, allArena, allRec);
+    charge({ "charge.QuantiledQdx*" }, quantileArena, quantileRec);
+    bool same = true;
+    std::size_t nValues = 0;
+    for(int plane = 0; plane < cfg.nPlanes; plane++){
+      auto const & x = allRec.PlaneQuantiledQdx[plane];
+      auto const & y = quantileRec.PlaneQuantiledQdx[plane];
+      same = same && x.size() == y.size() && std::memcmp(x.data(), y.data(), x.size() * sizeof(x[0])) == 0;
+      nValues += y.size();
+    }
+    std::printf("quantile-only charge selection: %zu QuantiledQdx values %s the full charge selection\n",
+                nValues, same ? "identical to" : "DIFFER from");
+  }
+
+  std::printf("batch kernels, %zu points of one event:\n", events[0].NPoints());
+  for(test::SimdLevel level : { test::SimdLevel::kScalar, test::SimdLevel::kAVX2, test::SimdLevel::kAVX512 }){
+    if(level <= test::DetectSimdLevel()) BenchKernels(level, events[0]);
+  }
+  return 0;
+}
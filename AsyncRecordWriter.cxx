@@ -0,0 +1,124 @@
+////////////////////////////////////////////////////////////////////////
+// File:        AsyncRecordWriter.cxx
+////////////////////////////////////////////////////////////////////////
+#include "AsyncRecordWriter.h"
+
+#include <chrono>
+#include <stdexcept>
+
+test::AsyncRecordWriter::AsyncRecordWriter(std::size_t depth, WriteFunction write)
+  : fBuffers(depth)
+  , fFree(depth)
+  , fFull(depth)
+  , fWrite(std::move(write))
+  , fOccupancy(new std::atomic<unsigned long>[depth])
+{
+  if(depth < 1) throw std::runtime_error("AsyncRecordWriter: depth must be at least 1");
+  for(std::size_t k = 0; k < depth; k++) fOccupancy[k].store(0, std::memory_order_relaxed);
+  for(std::size_t i = 0; i < depth; i++) fFree.TryPush(i);
+  fThread = std::thread(&AsyncRecordWriter::Run, this);
+}
+
+test::AsyncRecordWriter::~AsyncRecordWriter()
+{
+  try{
+    Close();
+  }
+  catch(...){
+  }
+}
+
+void test::AsyncRecordWriter::CheckError()
+{
+  if(fFailed.load(std::memory_order_acquire)) std::rethrow_exception(fError);
+}
+
+void test::AsyncRecordWriter::Submit(EventRecord const & record, RecordMask const & mask)
+{
+  CheckError();
+
+  std::size_t index;
+  if(!fFree.TryPop(index)){
+    // Every buffer is in flight: wait for the writer to return one
+    auto const start = std::chrono::steady_clock::now();
+    for(unsigned spin = 0; !fFree.TryPop(index); spin++){
+      CheckError();
+      if(spin < 64) std::this_thread::yield();
+      else std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+    double const waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::lock_guard<std::mutex> lock(fStallMutex);
+    fStalls.Add(waited);
+  }
+  fOccupancy[fInFlight.fetch_add(1)].fetch_add(1, std::memory_order_relaxed); // others' buffers, < Depth()
+
+  fBuffers[index].Assign(record, mask);
+  // The ticket taken here fixes the write order; there is always room, as
+  // at most Depth() indices circulate
+  fFull.TryPush(index);
+  fSubmitted.fetch_add(1, std::memory_order_relaxed);
+  if(fWriterIdle.load()){
+    std::lock_guard<std::mutex> lock(fWakeMutex);
+    fWake.notify_one();
+  }
+}
+
+void test::AsyncRecordWriter::Run()
+{
+  for(;;){
+    std::size_t index;
+    if(!fFull.TryPop(index)){
+      // Close() comes after the last Submit(): an empty queue is then final
+      if(fClosing.load(std::memory_order_acquire)){
+        if(!fFull.TryPop(index)) return;
+      }
+      else{
+        // Idle: announce it, then look once more so that a record pushed
+        // in between is not left waiting for the timeout
+        std::unique_lock<std::mutex> lock(fWakeMutex);
+        fWriterIdle.store(true);
+        bool const popped = fFull.TryPop(index);
+        if(!popped && !fClosing.load()) fWake.wait_for(lock, std::chrono::milliseconds(1));
+        fWriterIdle.store(false);
+        if(!popped) continue;
+      }
+    }
+
+    if(!fFailed.load(std::memory_order_relaxed)){
+      auto const start = std::chrono::steady_clock::now();
+      try{
+        fWrite(fBuffers[index]);
+      }
+      catch(...){
+        // Keep recycling the buffers so that no producer waits forever
+        fError = std::current_exception();
+        fFailed.store(true, std::memory_order_release);
+      }
+      fWriteSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    fInFlight.fetch_sub(1);
+    fFree.TryPush(index);
+  }
+}
+
+void test::AsyncRecordWriter::Close()
+{
+  if(!fThread.joinable()){
+    CheckError();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(fWakeMutex);
+    fClosing.store(true, std::memory_order_release);
+    fWake.notify_one();
+  }
+  fThread.join();
+  CheckError();
+}
+
+std::vector<unsigned long> test::AsyncRecordWriter::Occupancy() const
+{
+  std::vector<unsigned long> occupancy(Depth());
+  for(std::size_t k = 0; k < Depth(); k++) occupancy[k] = fOccupancy[k].load(std::memory_order_relaxed);
+  return occupancy;
+}
@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       AsyncRecordWriter
+// File:        AsyncRecordWriter.h
+//
+// Hands completed event records to one background writer thread, so the
+// tree fill (compression, basket flushes) runs off the event loop. A
+// fixed pool of Depth() TreeRecord buffers circulates between two
+// BoundedQueues: Submit() takes a free buffer, copies the record into
+// it and queues it; the writer thread passes it to the write function
+// and returns it to the free queue, capacity intact. Records are written
+// in the order Submit() queued them. When every buffer is in flight the
+// submitting thread waits, and the wait is booked as a stall.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_ASYNCRECORDWRITER_H
+#define MYPDDPTESTANA_ASYNCRECORDWRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "BoundedQueue.h"
+#include "EventRecord.h"
+#include "PhaseTimer.h"
+
+namespace test {
+
+  class AsyncRecordWriter {
+  public:
+    // Called on the writer thread, one record at a time, in order; it may
+    // swap the content of the record out (the buffer is refilled anyway)
+    using WriteFunction = std::function<void(TreeRecord &)>;
+
+    AsyncRecordWriter(std::size_t depth, WriteFunction write);
+    ~AsyncRecordWriter(); // Close(), errors of the writer dropped
+
+    AsyncRecordWriter(AsyncRecordWriter const &) = delete;
+    AsyncRecordWriter & operator = (AsyncRecordWriter const &) = delete;
+
+    // Copy the enabled content of record to the writer; thread safe.
+    // Rethrows an exception the write function threw.
+    void Submit(EventRecord const & record, RecordMask const & mask = RecordMask());
+
+    // Write everything submitted and stop the thread; rethrows an
+    // exception the write function threw. No Submit() may run concurrently.
+    void Close();
+
+    std::size_t Depth() const { return fBuffers.size(); }
+    unsigned long Submitted() const { return fSubmitted.load(); }
+
+    // Occupancy()[k]: submissions that found k other records in flight
+    // (being copied, queued or written), k in [0, Depth())
+    std::vector<unsigned long> Occupancy() const;
+    // Waits of Submit() for a free buffer; read after Close()
+    LatencyHistogram const & Stalls() const { return fStalls; }
+    // Time the writer thread spent in the write function [s]; read after Close()
+    double WriteSeconds() const { return fWriteSeconds; }
+
+  private:
+    void Run();
+    void CheckError();
+
+    std::vector<TreeRecord> fBuffers;
+    BoundedQueue<std::size_t> fFree;  // indices of the buffers Submit() may fill
+    BoundedQueue<std::size_t> fFull;  // indices of the buffers to write, in order
+    WriteFunction fWrite;
+
+    std::atomic<std::size_t> fInFlight{0};
+    std::unique_ptr< std::atomic<unsigned long>[] > fOccupancy;
+    std::atomic<unsigned long> fSubmitted{0};
+    std::mutex fStallMutex;
+    LatencyHistogram fStalls;
+    double fWriteSeconds = 0.;
+
+    // Idle writer: sleeps on fWake until a record or Close() arrives
+    std::mutex fWakeMutex;
+    std::condition_variable fWake;
+    std::atomic<bool> fWriterIdle{false};
+    std::atomic<bool> fClosing{false};
+    std::atomic<bool> fFailed{false};
+    std::exception_ptr fError;
+    std::thread fThread;
+  };
+
+}
+
+#endif
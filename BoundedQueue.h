@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       BoundedQueue
+// File:        BoundedQueue.h
+//
+// Bounded lock-free multi-producer / multi-consumer FIFO (D. Vyukov's
+// array queue). Each cell carries a sequence number telling whether it
+// is free for the producer or ready for the consumer of a given ticket,
+// so a push or pop is one CAS on the shared position plus one store.
+// Elements come out in the order their pushes claimed a ticket.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_BOUNDEDQUEUE_H
+#define MYPDDPTESTANA_BOUNDEDQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace test {
+
+  template <typename T>
+  class BoundedQueue {
+  public:
+    // Capacity rounded up to a power of two
+    explicit BoundedQueue(std::size_t capacity)
+    {
+      std::size_t n = 1;
+      while(n < capacity) n <<= 1;
+      fCells.reset(new Cell[n]);
+      fMask = n - 1;
+      for(std::size_t i = 0; i < n; i++) fCells[i].sequence.store(i, std::memory_order_relaxed);
+      fEnqueuePos.store(0, std::memory_order_relaxed);
+      fDequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(BoundedQueue const &) = delete;
+    BoundedQueue & operator = (BoundedQueue const &) = delete;
+
+    std::size_t Capacity() const { return fMask + 1; }
+
+    // False when the queue is full
+    bool TryPush(T const & value)
+    {
+      std::size_t pos = fEnqueuePos.load(std::memory_order_relaxed);
+      for(;;){
+        Cell & cell = fCells[pos & fMask];
+        std::size_t const seq = cell.sequence.load(std::memory_order_acquire);
+        std::ptrdiff_t const diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+        if(diff == 0){
+          if(fEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+            cell.value = value;
+            cell.sequence.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        }
+        else if(diff < 0) return false;
+        else pos = fEnqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+
+    // False when the queue is empty
+    bool TryPop(T & value)
+    {
+      std::size_t pos = fDequeuePos.load(std::memory_order_relaxed);
+      for(;;){
+        Cell & cell = fCells[pos & fMask];
+        std::size_t const seq = cell.sequence.load(std::memory_order_acquire);
+        std::ptrdiff_t const diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+        if(diff == 0){
+          if(fDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+            value = cell.value;
+            cell.sequence.store(pos + fMask + 1, std::memory_order_release);
+            return true;
+          }
+        }
+        else if(diff < 0) return false;
+        else pos = fDequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+
+  private:
+    struct Cell {
+      std::atomic<std::size_t> sequence;
+      T value;
+    };
+
+    std::unique_ptr<Cell[]> fCells;
+    std::size_t fMask;
+    // On separate cache lines so producers and consumers do not share one
+    alignas(64) std::atomic<std::size_t> fEnqueuePos;
+    alignas(64) std::atomic<std::size_t> fDequeuePos;
+  };
+
+}
+
+#endif
@@ -0,0 +1,68 @@
+////////////////////////////////////////////////////////////////////////
+// File:        BranchSelection.cxx
+////////////////////////////////////////////////////////////////////////
+#include "BranchSelection.h"
+
+#include <stdexcept>
+
+test::BranchSelection::BranchSelection(int nPlanes)
+  : histograms(false)
+{
+  mask.fields.reset();
+  for(std::vector<bool> & planes : mask.planes) planes.assign(nPlanes, false);
+}
+
+bool test::WildcardMatch(char const * pattern, char const * text)
+{
+  // Greedy matching with backtracking to the last "*"
+  char const * star = nullptr;
+  char const * resume = nullptr;
+  while(*text){
+    if(*pattern == '*'){
+      star = pattern++;
+      resume = text;
+    }
+    else if(*pattern == '?' || *pattern == *text){
+      pattern++;
+      text++;
+    }
+    else if(star){
+      pattern = star + 1;
+      text = ++resume;
+    }
+    else return false;
+  }
+  while(*pattern == '*') pattern++;
+  return !*pattern;
+}
+
+void test::BranchSelection::Apply(std::vector<std::string> const & patterns, int nPlanes)
+{
+  for(std::string const & entry : patterns){
+    bool const enable = entry.empty() || entry[0] != '-';
+    std::string const pattern = enable ? entry : entry.substr(1);
+    bool const qualified = pattern.find('.') != std::string::npos;
+    auto const matches = [&](std::string const & group, std::string const & name){
+      return WildcardMatch(pattern.c_str(), (qualified ? group + "." + name : name).c_str());
+    };
+
+    bool matched = false;
+    for(int f = 0; f < kNRecordFields; f++){
+      if(!matches(kRecordFieldGroups[f], kRecordFieldNames[f])) continue;
+      mask.fields[f] = enable;
+      matched = true;
+    }
+    for(int f = 0; f < kNRecordPlaneFields; f++){
+      for(int plane = 0; plane < nPlanes; plane++){
+        if(!matches(kRecordPlaneFieldGroups[f], kRecordPlaneFieldNames[f] + std::to_string(plane))) continue;
+        mask.planes[f][plane] = enable;
+        matched = true;
+      }
+    }
+    if(matches("hist", "hdQdx")){
+      histograms = enable;
+      matched = true;
+    }
+    if(!matched) throw std::runtime_error("no branch matches '" + pattern + "'");
+  }
+}
@@ -0,0 +1,47 @@
+////////////////////////////////////////////////////////////////////////
+// File:        BranchSelection.h
+//
+// Output selection of MyPDDPTestAna from a list of branch patterns.
+// Every mytree branch is named "group.name" after its schema group
+// (EventRecord.h):
+//
+//   event.*   eventID, nPFParticles, nPrimaries, nTracks, nPrimaryDaughters
+//   track.*   TrackLength, nHits, Start*, End*, StartTick
+//   hits.*    View, PeakTime, HitIntegral, TrackHitOffset
+//   points.*  X, Y, Z, TrackPointOffset
+//   calo.*    Planenum, PointdQdx, PointPlane, dQdx<plane>
+//   charge.*  TruncMeandQdx<plane>, MediandQdx<plane>, QuantiledQdx<plane>
+//   hist.*    hdQdx: the dQ/dx histograms (combined and per plane)
+//
+// Patterns are applied in order; "*" and "?" are wildcards, a leading
+// "-" disables what the pattern matches, and a pattern without a "."
+// is matched against the bare name (e.g. "dQdx*", "-PeakTime").
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_BRANCHSELECTION_H
+#define MYPDDPTESTANA_BRANCHSELECTION_H
+
+#include <string>
+#include <vector>
+
+#include "EventRecord.h"
+
+namespace test {
+
+  struct BranchSelection {
+    RecordMask mask;        // mytree branches
+    bool histograms = true; // hist.hdQdx
+
+    // Nothing enabled, nPlanes dQdx<plane> columns
+    explicit BranchSelection(int nPlanes);
+
+    // Apply patterns in order; throws std::runtime_error on a pattern that
+    // matches no branch
+    void Apply(std::vector<std::string> const & patterns, int nPlanes);
+  };
+
+  // Shell-style match of text against pattern with "*" and "?"
+  bool WildcardMatch(char const * pattern, char const * text);
+
+}
+
+#endif
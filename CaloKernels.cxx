@@ -0,0 +1,205 @@
+////////////////////////////////////////////////////////////////////////
+// File:        CaloKernels.cxx
+////////////////////////////////////////////////////////////////////////
+#include "CaloKernels.h"
+
+#include <stdexcept>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MYPDDPTESTANA_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+  // ---------------------------------------------------------------- scalar
+
+  // Used at every level: the compiler vectorizes these loops on its own,
+  // and hand-written AVX2 / AVX-512 versions measured slower
+  void DivideScalar(float const * in, float const * divisor, float c, float * out, std::size_t n)
+  {
+    if(divisor){
+      for(std::size_t i = 0; i < n; i++) out[i] = in[i] / divisor[i];
+    }
+    else{
+      for(std::size_t i = 0; i < n; i++) out[i] = in[i] / c;
+    }
+  }
+
+  inline int BinOf(double x, double xmin, double xmax, int nbins)
+  {
+    if(!(x >= xmin)) return 0;
+    if(x >= xmax) return nbins + 1;
+    return 1 + int(nbins * (x - xmin) / (xmax - xmin));
+  }
+
+  void BinIndicesScalar(float const * x, std::size_t n, double xmin, double xmax, int nbins, int * bins)
+  {
+    for(std::size_t i = 0; i < n; i++) bins[i] = BinOf(x[i], xmin, xmax, nbins);
+  }
+
+  void DeinterleaveScalar(double const * xyz, std::size_t n, double * x, double * y, double * z)
+  {
+    for(std::size_t i = 0; i < n; i++){
+      x[i] = xyz[3*i]; y[i] = xyz[3*i + 1]; z[i] = xyz[3*i + 2];
+    }
+  }
+
+#ifdef MYPDDPTESTANA_X86_KERNELS
+
+  // ------------------------------------------------------------------ AVX2
+
+  // Same operations and order as BinOf, so the bins match exactly
+  __attribute__((target("avx2")))
+  void BinIndicesAVX2(float const * x, std::size_t n, double xmin, double xmax, int nbins, int * bins)
+  {
+    __m256d const vmin = _mm256_set1_pd(xmin);
+    __m256d const vmax = _mm256_set1_pd(xmax);
+    __m256d const vn = _mm256_set1_pd(nbins);
+    __m256d const vwidth = _mm256_set1_pd(xmax - xmin);
+    __m256d const one = _mm256_set1_pd(1.);
+    __m256d const overflow = _mm256_set1_pd(nbins + 1);
+    __m256d const zero = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4){
+      __m256d const v = _mm256_cvtps_pd(_mm_loadu_ps(x + i));
+      __m256d const t = _mm256_div_pd(_mm256_mul_pd(vn, _mm256_sub_pd(v, vmin)), vwidth);
+      __m256d bin = _mm256_add_pd(one, _mm256_round_pd(t, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC));
+      bin = _mm256_blendv_pd(bin, overflow, _mm256_cmp_pd(v, vmax, _CMP_GE_OQ));
+      bin = _mm256_blendv_pd(zero, bin, _mm256_cmp_pd(v, vmin, _CMP_GE_OQ));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(bins + i), _mm256_cvttpd_epi32(bin));
+    }
+    BinIndicesScalar(x + i, n - i, xmin, xmax, nbins, bins + i);
+  }
+
+  // 4 points = 12 doubles in three registers:
+  //   a = x0 y0 z0 x1, b = y1 z1 x2 y2, c = z2 x3 y3 z3
+  __attribute__((target("avx2")))
+  void DeinterleaveAVX2(double const * xyz, std::size_t n, double * x, double * y, double * z)
+  {
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4){
+      double const * p = xyz + 3*i;
+      __m256d const a = _mm256_loadu_pd(p);
+      __m256d const b = _mm256_loadu_pd(p + 4);
+      __m256d const c = _mm256_loadu_pd(p + 8);
+      __m256d const xs = _mm256_blend_pd(_mm256_blend_pd(a, b, 0x4), c, 0x2);  // x0 x3 x2 x1
+      __m256d const ys = _mm256_blend_pd(_mm256_blend_pd(a, b, 0x9), c, 0x4);  // y1 y0 y3 y2
+      __m256d const zs = _mm256_blend_pd(_mm256_blend_pd(a, b, 0x2), c, 0x9);  // z2 z1 z0 z3
+      _mm256_storeu_pd(x + i, _mm256_permute4x64_pd(xs, _MM_SHUFFLE(1, 2, 3, 0)));
+      _mm256_storeu_pd(y + i, _mm256_permute4x64_pd(ys, _MM_SHUFFLE(2, 3, 0, 1)));
+      _mm256_storeu_pd(z + i, _mm256_permute4x64_pd(zs, _MM_SHUFFLE(3, 0, 1, 2)));
+    }
+    DeinterleaveScalar(xyz + 3*i, n - i, x + i, y + i, z + i);
+  }
+
+  // --------------------------------------------------------------- AVX-512
+
+  // GCC 12 warns about the deliberately undefined pass-through operands
+  // inside its own AVX-512 intrinsics once they are inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+  __attribute__((target("avx512f")))
+  void BinIndicesAVX512(float const * x, std::size_t n, double xmin, double xmax, int nbins, int * bins)
+  {
+    __m512d const vmin = _mm512_set1_pd(xmin);
+    __m512d const vmax = _mm512_set1_pd(xmax);
+    __m512d const vn = _mm512_set1_pd(nbins);
+    __m512d const vwidth = _mm512_set1_pd(xmax - xmin);
+    __m512d const one = _mm512_set1_pd(1.);
+    __m512d const overflow = _mm512_set1_pd(nbins + 1);
+    __m512d const zero = _mm512_setzero_pd();
+    std::size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+      __m512d const v = _mm512_cvtps_pd(_mm256_loadu_ps(x + i));
+      __m512d const t = _mm512_div_pd(_mm512_mul_pd(vn, _mm512_sub_pd(v, vmin)), vwidth);
+      __m512d bin = _mm512_add_pd(one, _mm512_roundscale_pd(t, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC));
+      bin = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(v, vmax, _CMP_GE_OQ), bin, overflow);
+      bin = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(v, vmin, _CMP_GE_OQ), zero, bin);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(bins + i), _mm512_cvttpd_epi32(bin));
+    }
+    BinIndicesScalar(x + i, n - i, xmin, xmax, nbins, bins + i);
+  }
+
+  // 8 points = 24 doubles in three registers; each column takes its first
+  // entries from the first two registers and the rest from the third
+  __attribute__((target("avx512f")))
+  void DeinterleaveAVX512(double const * xyz, std::size_t n, double * x, double * y, double * z)
+  {
+    __m512i const x01 = _mm512_setr_epi64(0, 3, 6, 9, 12, 15, 0, 0);
+    __m512i const x2  = _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 10, 13);
+    __m512i const y01 = _mm512_setr_epi64(1, 4, 7, 10, 13, 0, 0, 0);
+    __m512i const y2  = _mm512_setr_epi64(0, 1, 2, 3, 4, 8, 11, 14);
+    __m512i const z01 = _mm512_setr_epi64(2, 5, 8, 11, 14, 0, 0, 0);
+    __m512i const z2  = _mm512_setr_epi64(0, 1, 2, 3, 4, 9, 12, 15);
+    std::size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+      double const * p = xyz + 3*i;
+      __m512d const a = _mm512_loadu_pd(p);
+      __m512d const b = _mm512_loadu_pd(p + 8);
+      __m512d const c = _mm512_loadu_pd(p + 16);
+      _mm512_storeu_pd(x + i, _mm512_permutex2var_pd(_mm512_permutex2var_pd(a, x01, b), x2, c));
+      _mm512_storeu_pd(y + i, _mm512_permutex2var_pd(_mm512_permutex2var_pd(a, y01, b), y2, c));
+      _mm512_storeu_pd(z + i, _mm512_permutex2var_pd(_mm512_permutex2var_pd(a, z01, b), z2, c));
+    }
+    DeinterleaveScalar(xyz + 3*i, n - i, x + i, y + i, z + i);
+  }
+
+#pragma GCC diagnostic pop
+
+#endif // MYPDDPTESTANA_X86_KERNELS
+
+  test::CaloKernels const kScalarKernels{ test::SimdLevel::kScalar, DivideScalar, BinIndicesScalar, DeinterleaveScalar };
+#ifdef MYPDDPTESTANA_X86_KERNELS
+  test::CaloKernels const kAVX2Kernels{ test::SimdLevel::kAVX2, DivideScalar, BinIndicesAVX2, DeinterleaveAVX2 };
+  test::CaloKernels const kAVX512Kernels{ test::SimdLevel::kAVX512, DivideScalar, BinIndicesAVX512, DeinterleaveAVX512 };
+#endif
+
+}
+
+test::SimdLevel test::DetectSimdLevel()
+{
+#ifdef MYPDDPTESTANA_X86_KERNELS
+  static SimdLevel const level = []{
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) return SimdLevel::kAVX512;
+    if(__builtin_cpu_supports("avx2")) return SimdLevel::kAVX2;
+    return SimdLevel::kScalar;
+  }();
+  return level;
+#else
+  return SimdLevel::kScalar;
+#endif
+}
+
+test::CaloKernels const & test::GetCaloKernels(SimdLevel level)
+{
+  SimdLevel const best = DetectSimdLevel();
+  if(level == SimdLevel::kAuto || level > best) level = best;
+#ifdef MYPDDPTESTANA_X86_KERNELS
+  if(level == SimdLevel::kAVX512) return kAVX512Kernels;
+  if(level == SimdLevel::kAVX2) return kAVX2Kernels;
+#endif
+  return kScalarKernels;
+}
+
+test::SimdLevel test::ParseSimdLevel(std::string const & name)
+{
+  if(name == "auto") return SimdLevel::kAuto;
+  if(name == "scalar") return SimdLevel::kScalar;
+  if(name == "avx2") return SimdLevel::kAVX2;
+  if(name == "avx512") return SimdLevel::kAVX512;
+  throw std::runtime_error("unknown SIMD level '" + name + "' (expected auto, scalar, avx2 or avx512)");
+}
+
+char const * test::SimdLevelName(SimdLevel level)
+{
+  switch(level){
+  case SimdLevel::kAuto:   return "auto";
+  case SimdLevel::kScalar: return "scalar";
+  case SimdLevel::kAVX2:   return "avx2";
+  case SimdLevel::kAVX512: return "avx512";
+  }
+  return "?";
+}
@@ -0,0 +1,49 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       CaloKernels
+// File:        CaloKernels.h
+//
+// Batch kernels over the points of one calorimetry object: dQ/dx
+// scaling, histogram bin indices and x/y/z deinterleaving into
+// separate columns. The bin indices and deinterleaving have a scalar
+// version and AVX2 / AVX-512 versions, compiled with per-function target
+// attributes and selected at run time from the CPU features, so the
+// library itself needs no -mavx flags; the scaling is the scalar loop at
+// every level. All versions give bit-identical results.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_CALOKERNELS_H
+#define MYPDDPTESTANA_CALOKERNELS_H
+
+#include <cstddef>
+#include <string>
+
+namespace test {
+
+  enum class SimdLevel { kAuto, kScalar, kAVX2, kAVX512 };
+
+  struct CaloKernels {
+    SimdLevel level;
+
+    // out[i] = in[i] / divisor[i], or in[i] / c when divisor is null
+    void (*divide)(float const * in, float const * divisor, float c, float * out, std::size_t n);
+
+    // HistPartial bin of each x (0 underflow and NaN, nbins+1 overflow)
+    void (*binIndices)(float const * x, std::size_t n, double xmin, double xmax, int nbins, int * bins);
+
+    // Interleaved x, y, z triplets into three columns
+    void (*deinterleave)(double const * xyz, std::size_t n, double * x, double * y, double * z);
+  };
+
+  // Best level supported by this CPU
+  SimdLevel DetectSimdLevel();
+
+  // Kernels of the requested level, lowered to what the CPU supports;
+  // kAuto gives DetectSimdLevel()
+  CaloKernels const & GetCaloKernels(SimdLevel level = SimdLevel::kAuto);
+
+  // "auto", "scalar", "avx2", "avx512"; throws std::runtime_error otherwise
+  SimdLevel ParseSimdLevel(std::string const & name);
+  char const * SimdLevelName(SimdLevel level);
+
+}
+
+#endif
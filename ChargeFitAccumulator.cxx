@@ -0,0 +1,66 @@
+////////////////////////////////////////////////////////////////////////
+// File:        ChargeFitAccumulator.cxx
+////////////////////////////////////////////////////////////////////////
+#include "ChargeFitAccumulator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void test::ChargeFitAccumulator::Configure(ChargeFitConfig const & config)
+{
+  fConfig = config;
+  fDriftScale = fConfig.nDriftSlices / (fConfig.tMax - fConfig.tMin);
+  fChargeScale = fConfig.nChargeBins / fConfig.qMax;
+  for(bool & uses : fUses) uses = false;
+  fSets.clear();
+  if(!fConfig.enable) return;
+
+  int const sizes[kNDimensions] = { fConfig.nPlanes, fConfig.nCRPs, fConfig.nDriftSlices };
+  for(std::string const & name : fConfig.sets){
+    Set set;
+    set.name = name;
+    set.nHistograms = 1;
+    for(std::size_t begin = 0, end; begin <= name.size(); begin = end + 1){
+      end = std::min(name.find(':', begin), name.size());
+      std::string const dim = name.substr(begin, end - begin);
+      Dimension d;
+      if(dim == "plane") d = kPlane;
+      else if(dim == "crp") d = kCRP;
+      else if(dim == "drift") d = kDrift;
+      else throw std::runtime_error("ChargeFitAccumulator: unknown dimension '" + dim + "' in set '" + name + "' (expected plane, crp or drift)");
+      if(sizes[d] < 1) throw std::runtime_error("ChargeFitAccumulator: dimension '" + dim + "' has no bins");
+      set.dims.push_back(d);
+      set.sizes.push_back(sizes[d]);
+      set.nHistograms *= sizes[d];
+      fUses[d] = true;
+    }
+    set.counts.assign(std::size_t(set.nHistograms) * (fConfig.nChargeBins + 1), 0);
+    fSets.push_back(std::move(set));
+  }
+  if(fSets.empty()) throw std::runtime_error("ChargeFitAccumulator: no histogram set");
+}
+
+void test::ChargeFitAccumulator::Merge(ChargeFitAccumulator const & other)
+{
+  for(std::size_t s = 0; s < fSets.size() && s < other.fSets.size(); s++){
+    std::vector<unsigned long> & counts = fSets[s].counts;
+    std::vector<unsigned long> const & more = other.fSets[s].counts;
+    for(std::size_t i = 0; i < counts.size() && i < more.size(); i++) counts[i] += more[i];
+  }
+}
+
+void test::ChargeFitAccumulator::Coordinates(Set const & set, int h, int coordinates[kNDimensions]) const
+{
+  for(int d = 0; d < kNDimensions; d++) coordinates[d] = -1;
+  // Row-major: the last dimension varies fastest
+  for(std::size_t d = set.dims.size(); d-- > 0; ){
+    coordinates[set.dims[d]] = h % set.sizes[d];
+    h /= set.sizes[d];
+  }
+}
+
+test::LangausFitResult test::ChargeFitAccumulator::Fit(Set const & set, int h, LangausFitConfig const & config) const
+{
+  // Overflow bin left out
+  return FitLangaus(&set.counts[std::size_t(h) * (fConfig.nChargeBins + 1)], fConfig.nChargeBins, 0., fConfig.qMax, config);
+}
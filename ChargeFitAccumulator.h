@@ -0,0 +1,120 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       ChargeFitAccumulator
+// File:        ChargeFitAccumulator.h
+//
+// dQ/dx histograms of the calorimetry points of the selected tracks,
+// split along configurable sets of detector dimensions, for the
+// Landau-Gaussian MPV fits of the calibration (LangausFit.h). A set is a
+// ":"-separated list of dimensions:
+//
+//   plane   readout plane (view)
+//   crp     charge readout plane, from the channel of the point's hit
+//   drift   drift-time slice, from the point's x position
+//
+// e.g. "plane", "crp:plane" or "drift:plane"; a set holds one histogram
+// per combination of its dimensions. Counts are integers, so partials
+// merge exactly; the fits run once at the end of the job.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_CHARGEFITACCUMULATOR_H
+#define MYPDDPTESTANA_CHARGEFITACCUMULATOR_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "LangausFit.h"
+
+namespace test {
+
+  struct ChargeFitConfig {
+    bool enable = false;
+    std::vector<std::string> sets = { "plane" };
+    int nPlanes = 2;
+    // CRP of a channel: channel / channelsPerCRP, below nCRPs
+    unsigned int channelsPerCRP = 1920;
+    int nCRPs = 4;
+    // Drift time from the point position: t = (anodeX - x) / driftVelocity,
+    // nDriftSlices slices over [tMin, tMax) [us]
+    double anodeX = 300.;         // [cm]
+    double driftVelocity = 0.16;  // [cm/us]
+    int nDriftSlices = 20;
+    double tMin = 0., tMax = 4000.;
+    // dQ/dx binning of every histogram [fC/cm], last bin for the overflow
+    int nChargeBins = 200;
+    double qMax = 20.;
+  };
+
+  class ChargeFitAccumulator {
+  public:
+    enum Dimension { kPlane, kCRP, kDrift, kNDimensions };
+    static constexpr unsigned int kNoChannel = ~0u;
+
+    struct Set {
+      std::string name;
+      std::vector<Dimension> dims;
+      std::vector<int> sizes;          // of each dimension
+      int nHistograms = 0;
+      std::vector<unsigned long> counts; // [histogram][charge bin + overflow]
+    };
+
+    // Throws std::runtime_error on an unknown dimension or an empty set
+    void Configure(ChargeFitConfig const & config);
+    ChargeFitConfig const & Config() const { return fConfig; }
+    bool Enabled() const { return fConfig.enable; }
+    // Whether a set splits by CRP, which needs the hit channel of each point
+    bool UsesChannels() const { return fUses[kCRP]; }
+
+    void Add(int plane, double x, unsigned int channel, double dQdx)
+    {
+      int index[kNDimensions];
+      index[kPlane] = plane < fConfig.nPlanes ? plane : -1;
+      index[kCRP] = -1;
+      if(fUses[kCRP] && channel != kNoChannel){
+        unsigned int const crp = channel / fConfig.channelsPerCRP;
+        if(crp < unsigned(fConfig.nCRPs)) index[kCRP] = crp;
+      }
+      index[kDrift] = -1;
+      if(fUses[kDrift]){
+        double const t = (fConfig.anodeX - x) / fConfig.driftVelocity;
+        if(t >= fConfig.tMin && t < fConfig.tMax){
+          // Rounding can give nDriftSlices just below tMax
+          index[kDrift] = std::min(int((t - fConfig.tMin) * fDriftScale), fConfig.nDriftSlices - 1);
+        }
+      }
+      int iq = dQdx > 0. ? int(dQdx * fChargeScale) : 0;
+      if(iq >= fConfig.nChargeBins) iq = fConfig.nChargeBins; // overflow bin
+
+      for(Set & set : fSets){
+        int h = 0;
+        for(std::size_t d = 0; d < set.dims.size(); d++){
+          int const i = index[set.dims[d]];
+          if(i < 0){ h = -1; break; }
+          h = h * set.sizes[d] + i;
+        }
+        if(h >= 0) set.counts[std::size_t(h) * (fConfig.nChargeBins + 1) + iq]++;
+      }
+    }
+
+    void Merge(ChargeFitAccumulator const & other);
+
+    std::vector<Set> const & Sets() const { return fSets; }
+    // Index along each dimension of the set of histogram h (-1 for the
+    // dimensions the set does not split)
+    void Coordinates(Set const & set, int h, int coordinates[kNDimensions]) const;
+    double DriftSliceCentre(int slice) const { return fConfig.tMin + (slice + 0.5) / fDriftScale; }
+
+    // Landau-Gaussian fit of histogram h of set; const, so the histograms
+    // can be fitted concurrently
+    LangausFitResult Fit(Set const & set, int h, LangausFitConfig const & config) const;
+
+  private:
+    ChargeFitConfig fConfig;
+    double fDriftScale = 0.;  // slices per us
+    double fChargeScale = 0.; // bins per fC/cm
+    bool fUses[kNDimensions] = { false, false, false };
+    std::vector<Set> fSets;
+  };
+
+}
+
+#endif
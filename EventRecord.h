@@ -0,0 +1,330 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       EventRecord
+// File:        EventRecord.h
+//
+// Content of one "mytree" entry of MyPDDPTestAna, and the fixed-binning
+// histogram buffer the per-point dQ/dx is filled into. Plain C++, shared
+// by the art module and the standalone processing core.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_EVENTRECORD_H
+#define MYPDDPTESTANA_EVENTRECORD_H
+
+#include <algorithm>
+#include <bitset>
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Schema of the event record, the single list every member, branch,
+// reset and reservation is generated from.
+//
+//   MYPDDPTESTANA_RECORD_SCALARS: ENTRY(type, name), one value per event
+//   MYPDDPTESTANA_RECORD_COLUMNS: ENTRY(element type, name, size, group), one
+//     vector per event whose length is bounded by the RecordSizes field size
+//
+//   MYPDDPTESTANA_RECORD_PLANE_COLUMNS: ENTRY(element type, name, size, group),
+//     one such column per readout plane (member Plane<name>, branches
+//     <name><plane>), as the plane count is only known at run time
+//
+// The branch of an entry has its name. Branches are enabled by group
+// ("group.name", BranchSelection.h); the scalars form the "event" group.
+#define MYPDDPTESTANA_RECORD_SCALARS(ENTRY) \
+  ENTRY(unsigned int, eventID)              \
+  ENTRY(unsigned int, nPFParticles)         \
+  ENTRY(unsigned int, nPrimaries)           \
+  ENTRY(int,          nTracks)              \
+  ENTRY(int,          nPrimaryDaughters)
+
+#define MYPDDPTESTANA_RECORD_COLUMNS(ENTRY)              \
+  ENTRY(double,       TrackLength,      tracks, track)   \
+  ENTRY(int,          nHits,            tracks, track)   \
+  ENTRY(double,       X,                points, points)  \
+  ENTRY(double,       Y,                points, points)  \
+  ENTRY(double,       Z,                points, points)  \
+  ENTRY(double,       StartX,           tracks, track)   \
+  ENTRY(double,       StartY,           tracks, track)   \
+  ENTRY(double,       StartZ,           tracks, track)   \
+  ENTRY(double,       EndX,             tracks, track)   \
+  ENTRY(double,       EndY,             tracks, track)   \
+  ENTRY(double,       EndZ,             tracks, track)   \
+  ENTRY(double,       StartTick,        tracks, track)   \
+  ENTRY(int,          View,             hits,   hits)    \
+  ENTRY(double,       PeakTime,         hits,   hits)    \
+  ENTRY(double,       HitIntegral,      hits,   hits)    \
+  ENTRY(int,          Planenum,         calos,  calo)    \
+  ENTRY(float,        PointdQdx,        points, calo)    \
+  ENTRY(int,          PointPlane,       points, calo)    \
+  ENTRY(unsigned int, TrackHitOffset,   tracks, hits)    \
+  ENTRY(unsigned int, TrackPointOffset, tracks, points)
+
+// dQdx: scaled dQ/dx of the points of each plane, in point order. The
+// per-track charge summaries over those points (-1 for a track without
+// points on the plane): truncated mean, median and the P2 estimate of a
+// configurable quantile (AnaCoreConfig::charge)
+#define MYPDDPTESTANA_RECORD_PLANE_COLUMNS(ENTRY)          \
+  ENTRY(float,        dQdx,             points, calo)     \
+  ENTRY(float,        TruncMeandQdx,    tracks, charge)   \
+  ENTRY(float,        MediandQdx,       tracks, charge)   \
+  ENTRY(float,        QuantiledQdx,     tracks, charge)
+
+namespace test {
+
+  enum RecordField {
+#define MYPDDPTESTANA_SCALAR(type, name) kRecord##name,
+#define MYPDDPTESTANA_COLUMN(type, name, size, group) kRecord##name,
+    MYPDDPTESTANA_RECORD_SCALARS(MYPDDPTESTANA_SCALAR)
+    MYPDDPTESTANA_RECORD_COLUMNS(MYPDDPTESTANA_COLUMN)
+#undef MYPDDPTESTANA_SCALAR
+#undef MYPDDPTESTANA_COLUMN
+    kNRecordFields
+  };
+
+  constexpr char const * kRecordFieldNames[kNRecordFields] = {
+#define MYPDDPTESTANA_SCALAR(type, name) #name,
+#define MYPDDPTESTANA_COLUMN(type, name, size, group) #name,
+    MYPDDPTESTANA_RECORD_SCALARS(MYPDDPTESTANA_SCALAR)
+    MYPDDPTESTANA_RECORD_COLUMNS(MYPDDPTESTANA_COLUMN)
+#undef MYPDDPTESTANA_SCALAR
+#undef MYPDDPTESTANA_COLUMN
+  };
+
+  constexpr char const * kRecordFieldGroups[kNRecordFields] = {
+#define MYPDDPTESTANA_SCALAR(type, name) "event",
+#define MYPDDPTESTANA_COLUMN(type, name, size, group) #group,
+    MYPDDPTESTANA_RECORD_SCALARS(MYPDDPTESTANA_SCALAR)
+    MYPDDPTESTANA_RECORD_COLUMNS(MYPDDPTESTANA_COLUMN)
+#undef MYPDDPTESTANA_SCALAR
+#undef MYPDDPTESTANA_COLUMN
+  };
+
+  enum RecordPlaneField {
+#define MYPDDPTESTANA_PLANE_COLUMN(type, name, size, group) kRecordPlane##name,
+    MYPDDPTESTANA_RECORD_PLANE_COLUMNS(MYPDDPTESTANA_PLANE_COLUMN)
+#undef MYPDDPTESTANA_PLANE_COLUMN
+    kNRecordPlaneFields
+  };
+
+  constexpr char const * kRecordPlaneFieldNames[kNRecordPlaneFields] = {
+#define MYPDDPTESTANA_PLANE_COLUMN(type, name, size, group) #name,
+    MYPDDPTESTANA_RECORD_PLANE_COLUMNS(MYPDDPTESTANA_PLANE_COLUMN)
+#undef MYPDDPTESTANA_PLANE_COLUMN
+  };
+
+  constexpr char const * kRecordPlaneFieldGroups[kNRecordPlaneFields] = {
+#define MYPDDPTESTANA_PLANE_COLUMN(type, name, size, group) #group,
+    MYPDDPTESTANA_RECORD_PLANE_COLUMNS(MYPDDPTESTANA_PLANE_COLUMN)
+#undef MYPDDPTESTANA_PLANE_COLUMN
+  };
+
+  // What the length of each entry follows: the RecordSizes field bounding
+  // a column, event for the scalars
+  enum class RecordLength { event, tracks, hits, calos, points };
+
+  constexpr RecordLength kRecordFieldLengths[kNRecordFields] = {
+#define MYPDDPTESTANA_SCALAR(type, name) RecordLength::event,
+#define MYPDDPTESTANA_COLUMN(type, name, size, group) RecordLength::size,
+    MYPDDPTESTANA_RECORD_SCALARS(MYPDDPTESTANA_SCALAR)
+    MYPDDPTESTANA_RECORD_COLUMNS(MYPDDPTESTANA_COLUMN)
+#undef MYPDDPTESTANA_SCALAR
+#undef MYPDDPTESTANA_COLUMN
+  };
+
+  constexpr RecordLength kRecordPlaneFieldLengths[kNRecordPlaneFields] = {
+#define MYPDDPTESTANA_PLANE_COLUMN(type, name, size, group) RecordLength::size,
+    MYPDDPTESTANA_RECORD_PLANE_COLUMNS(MYPDDPTESTANA_PLANE_COLUMN)
+#undef MYPDDPTESTANA_PLANE_COLUMN
+  };
+
+  // Which branches are written: one flag per schema entry, and per plane
+  // for the plane columns (all planes when a plane list is empty).
+  // Disabled entries are neither filled by the core, reserved nor copied
+  // to the branch buffers.
+  struct RecordMask {
+    std::bitset<kNRecordFields> fields;
+    std::vector<bool> planes[kNRecordPlaneFields];
+
+    RecordMask() { fields.set(); }
+    bool Field(RecordField f) const { return fields[f]; }
+    bool Plane(RecordPlaneField f, std::size_t plane) const { return plane >= planes[f].size() || planes[f][plane]; }
+    bool AnyPlane(RecordPlaneField f) const
+    {
+      return planes[f].empty() || std::find(planes[f].begin(), planes[f].end(), true) != planes[f].end();
+    }
+  };
+
+  // Column storage of a record: plain std::vector for the tree branch
+  // buffers, std::pmr::vector for the per-schedule records the core fills,
+  // which live on a RecordArena (RecordArena.h)
+  template <typename T> using VectorColumn = std::vector<T>;
+  template <typename T> using ArenaColumn = std::pmr::vector<T>;
+
+  template <template <typename> class Column>
+  struct BasicEventRecord {
+#define MYPDDPTESTANA_SCALAR(type, name) type name = 0;
+#define MYPDDPTESTANA_COLUMN(type, name, size, group) Column< type > name;
+    MYPDDPTESTANA_RECORD_SCALARS(MYPDDPTESTANA_SCALAR)
+    MYPDDPTESTANA_RECORD_COLUMNS(MYPDDPTESTANA_COLUMN)
+#undef MYPDDPTESTANA_SCALAR
+#undef MYPDDPTESTANA_COLUMN
+
+    // Columnar layout: PointdQdx and PointPlane are aligned with X/Y/Z, and
+    // track i owns hits [TrackHitOffset[i], TrackHitOffset[i+1]) and
+    // calorimetry points [TrackPointOffset[i], TrackPointOffset[i+1]).
+
+#define MYPDDPTESTANA_PLANE_COLUMN(type, name, size, group) Column< Column< type > > Plane##name;
+    MYPDDPTESTANA_RECORD_PLANE_COLUMNS(MYPDDPTESTANA_PLANE_COLUMN)
+#undef MYPDDPTESTANA_PLANE_COLUMN
+
+    // f(field, scalar, ...) on the same scalar of each record
+    template <typename F, typename... Records>
+    static void ForEachScalar(F && f, Records &... recs)
+    {
+#define MYPDDPTESTANA_SCALAR(type, name) f(kRecord##name, recs.name...);
+      MYPDDPTESTANA_RECORD_SCALARS(MYPDDPTESTANA_SCALAR)
+#undef MYPDDPTESTANA_SCALAR
+    }
+
+    // f(field, column, ...) on the same schema column of each record
+    template <typename F, typename... Records>
+    static void ForEachColumn(F && f, Records &... recs)
+    {
+#define MYPDDPTESTANA_COLUMN(type, name, size, group) f(kRecord##name, recs.name...);
+      MYPDDPTESTANA_RECORD_COLUMNS(MYPDDPTESTANA_COLUMN)
+#undef MYPDDPTESTANA_COLUMN
+    }
+
+    // f(field, plane, column, ...) on the same plane column of each record,
+    // for every plane of the first one
+    template <typename F, typename... Records>
+    static void ForEachPlaneColumn(F && f, Records &... recs)
+    {
+#define MYPDDPTESTANA_PLANE_COLUMN(type, name, bound, group) \
+      for(std::size_t plane = 0; plane < std::get<0>(std::tie(recs...)).Plane##name.size(); plane++){ \
+        f(kRecordPlane##name, plane, recs.Plane##name[plane]...); \
+      }
+      MYPDDPTESTANA_RECORD_PLANE_COLUMNS(MYPDDPTESTANA_PLANE_COLUMN)
+#undef MYPDDPTESTANA_PLANE_COLUMN
+    }
+
+    void Clear()
+    {
+      ForEachScalar([](RecordField, auto & value){ value = 0; }, *this);
+      ForEachColumn([](RecordField, auto & column){ column.clear(); }, *this);
+      ForEachPlaneColumn([](RecordPlaneField, std::size_t, auto & column){ column.clear(); }, *this);
+    }
+
+    // Number of columns of each plane column; the column objects stay in
+    // place as long as the count does not change, so they can be branched
+    void SetNPlanes(int n)
+    {
+#define MYPDDPTESTANA_PLANE_COLUMN(type, name, size, group) Plane##name.resize(n);
+      MYPDDPTESTANA_RECORD_PLANE_COLUMNS(MYPDDPTESTANA_PLANE_COLUMN)
+#undef MYPDDPTESTANA_PLANE_COLUMN
+    }
+    int NPlanes() const { return PlanedQdx.size(); }
+
+    // Copy the enabled content of a record with another column storage,
+    // keeping this record's column objects (and their capacity) in place
+    template <template <typename> class Other>
+    void Assign(BasicEventRecord<Other> const & other, RecordMask const & mask = RecordMask())
+    {
+      ForEachScalar([&mask](RecordField f, auto & to, auto const & from){
+          if(mask.Field(f)) to = from;
+        }, *this, other);
+      ForEachColumn([&mask](RecordField f, auto & to, auto const & from){
+          if(mask.Field(f)) to.assign(from.begin(), from.end());
+        }, *this, other);
+      SetNPlanes(other.NPlanes());
+      ForEachPlaneColumn([&mask](RecordPlaneField f, std::size_t plane, auto & to, auto const & from){
+          if(mask.Plane(f, plane)) to.assign(from.begin(), from.end());
+        }, *this, other);
+    }
+
+    // Exchange the content with a record of the same storage, keeping the
+    // column objects of both in place (the branch addresses stay valid).
+    // Both need the same plane count; not for arena records, whose
+    // buffers belong to their own resource.
+    void Swap(BasicEventRecord & other)
+    {
+      ForEachScalar([](RecordField, auto & a, auto & b){ std::swap(a, b); }, *this, other);
+      ForEachColumn([](RecordField, auto & a, auto & b){ a.swap(b); }, *this, other);
+      ForEachPlaneColumn([](RecordPlaneField, std::size_t, auto & a, auto & b){ a.swap(b); }, *this, other);
+    }
+
+    // Arena records only: drop every column buffer (they belong to an arena
+    // that is being reset) and allocate the new ones from resource. The
+    // columns are rebuilt because a pmr container never changes its
+    // resource on assignment.
+    void Rebind(std::pmr::memory_resource * resource)
+    {
+      auto const rebuild = [resource](auto & column){
+        using C = std::remove_reference_t<decltype(column)>;
+        column.~C();
+        new (&column) C(resource);
+      };
+      ForEachColumn([&rebuild](RecordField, auto & column){ rebuild(column); }, *this);
+#define MYPDDPTESTANA_PLANE_COLUMN(type, name, size, group) rebuild(Plane##name);
+      MYPDDPTESTANA_RECORD_PLANE_COLUMNS(MYPDDPTESTANA_PLANE_COLUMN)
+#undef MYPDDPTESTANA_PLANE_COLUMN
+    }
+  };
+
+  // Filled by the core, one per schedule
+  using EventRecord = BasicEventRecord<ArenaColumn>;
+  // Branch buffers of the output tree
+  using TreeRecord = BasicEventRecord<VectorColumn>;
+
+  // Fixed-binning fill buffer with the same layout as a TH1
+  // (bin 0 underflow, nbins+1 overflow), one per schedule or thread and
+  // converted to a TH1D at endJob. No statistics are kept while filling,
+  // and the counts are integers: partials merge exactly, so the merged
+  // histogram does not depend on which thread filled what.
+  struct HistPartial {
+    int nbins = 0;
+    double xmin = 0., xmax = 0.;
+    std::vector< unsigned long > counts;
+
+    void Reset(int n, double lo, double hi)
+    {
+      nbins = n; xmin = lo; xmax = hi;
+      counts.assign(nbins + 2, 0);
+    }
+
+    void Fill(double x)
+    {
+      int bin;
+      if(!(x >= xmin)) bin = 0;
+      else if(x >= xmax) bin = nbins + 1;
+      else bin = 1 + int(nbins * (x - xmin) / (xmax - xmin));
+      counts[bin]++;
+    }
+
+    // Bulk fill from precomputed bins (CaloKernels::binIndices)
+    void FillBins(int const * bins, std::size_t n)
+    {
+      unsigned long * c = counts.data();
+      for(std::size_t i = 0; i < n; i++) c[bins[i]]++;
+    }
+
+    // Add the counts of a partial with the same binning
+    void Merge(HistPartial const & other)
+    {
+      for(std::size_t bin = 0; bin < counts.size() && bin < other.counts.size(); bin++) counts[bin] += other.counts[bin];
+    }
+
+    // Fills, including the underflow and overflow
+    unsigned long Entries() const
+    {
+      unsigned long entries = 0;
+      for(unsigned long c : counts) entries += c;
+      return entries;
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////
+// File:        GainTable.cxx
+////////////////////////////////////////////////////////////////////////
+#include "GainTable.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+  constexpr char kMagic[8] = { 'P', 'D', 'D', 'P', 'G', 'A', 'I', 'N' };
+  constexpr std::uint32_t kVersion = 1;
+}
+
+test::GainTable::GainTable(std::string const & path)
+  : fPath(path)
+{
+  int const fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0) throw std::runtime_error("GainTable: cannot open " + path);
+  struct stat st;
+  if(::fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(Header)){
+    ::close(fd);
+    throw std::runtime_error("GainTable: " + path + " is too short for a gain table header");
+  }
+  fMapSize = st.st_size;
+  fMap = ::mmap(nullptr, fMapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if(fMap == MAP_FAILED){
+    fMap = nullptr;
+    throw std::runtime_error("GainTable: cannot map " + path);
+  }
+
+  Header header;
+  std::memcpy(&header, fMap, sizeof(header));
+  std::string problem;
+  if(std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) problem = "bad magic";
+  else if(header.version != kVersion) problem = "unsupported version";
+  else if(header.channelsPerEntry == 0) problem = "ChannelsPerEntry is 0";
+  else if(sizeof(Header) + std::size_t(header.nEntries) * sizeof(float) > fMapSize) problem = "truncated gain array";
+  if(!problem.empty()){
+    ::munmap(fMap, fMapSize);
+    fMap = nullptr;
+    throw std::runtime_error("GainTable: " + path + ": " + problem);
+  }
+
+  fGains = reinterpret_cast<float const *>(static_cast<char const *>(fMap) + sizeof(Header));
+  fNEntries = header.nEntries;
+  fChannelsPerEntry = header.channelsPerEntry;
+  fEntryShift = -1;
+  for(int shift = 0; shift < 32; shift++){
+    if(fChannelsPerEntry == 1u << shift) fEntryShift = shift;
+  }
+  fDefaultGain = header.defaultGain;
+}
+
+test::GainTable::~GainTable()
+{
+  if(fMap) ::munmap(fMap, fMapSize);
+}
+
+void test::GainTable::Write(std::string const & path, unsigned int channelsPerEntry,
+                            std::vector<float> const & gains, float defaultGain)
+{
+  Header header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.channelsPerEntry = channelsPerEntry;
+  header.nEntries = gains.size();
+  header.defaultGain = defaultGain;
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+  out.write(reinterpret_cast<char const *>(gains.data()), gains.size() * sizeof(float));
+  if(!out) throw std::runtime_error("GainTable: cannot write " + path);
+}
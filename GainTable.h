@@ -0,0 +1,72 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       GainTable
+// File:        GainTable.h
+//
+// Read-only, memory-mapped gain calibration table [ADC/fC] indexed by
+// readout channel. Each entry covers ChannelsPerEntry consecutive
+// channels, so the same format holds a per-channel table (1) or a
+// per-CRP / per-region table (e.g. the channel count of one CRP view).
+//
+// File layout (native endianness):
+//   char     magic[8]          "PDDPGAIN"
+//   uint32_t version           1
+//   uint32_t channelsPerEntry
+//   uint32_t nEntries
+//   float    defaultGain       used for channels beyond the table
+//   float    gains[nEntries]
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_GAINTABLE_H
+#define MYPDDPTESTANA_GAINTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace test {
+
+  class GainTable {
+  public:
+    struct Header {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t channelsPerEntry;
+      std::uint32_t nEntries;
+      float defaultGain;
+    };
+
+    // Maps the file; throws std::runtime_error if it is missing or malformed
+    explicit GainTable(std::string const & path);
+    ~GainTable();
+
+    GainTable(GainTable const &) = delete;
+    GainTable & operator = (GainTable const &) = delete;
+
+    float Gain(unsigned int channel) const
+    {
+      std::size_t const entry = fEntryShift >= 0 ? channel >> fEntryShift : channel / fChannelsPerEntry;
+      return entry < fNEntries ? fGains[entry] : fDefaultGain;
+    }
+    float DefaultGain() const { return fDefaultGain; }
+    std::size_t NEntries() const { return fNEntries; }
+    unsigned int ChannelsPerEntry() const { return fChannelsPerEntry; }
+    std::string const & Path() const { return fPath; }
+
+    // Write a table file, e.g. from a calibration job
+    static void Write(std::string const & path, unsigned int channelsPerEntry,
+                      std::vector<float> const & gains, float defaultGain);
+
+  private:
+    std::string fPath;
+    void * fMap = nullptr;
+    std::size_t fMapSize = 0;
+    float const * fGains = nullptr;
+    std::size_t fNEntries = 0;
+    unsigned int fChannelsPerEntry = 1;
+    int fEntryShift = 0; // log2(fChannelsPerEntry) when a power of 2 (per-channel tables), -1 otherwise
+    float fDefaultGain = 0.;
+  };
+
+}
+
+#endif
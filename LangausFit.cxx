@@ -0,0 +1,280 @@
+////////////////////////////////////////////////////////////////////////
+// File:        LangausFit.cxx
+////////////////////////////////////////////////////////////////////////
+#include "LangausFit.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+double test::LandauPdf(double x, double x0, double xi)
+{
+  // CERNLIB G110 DENLAN: rational approximations by range of v
+  static double const p1[5] = { 0.4259894875, -0.1249762550, 0.03984243700, -0.006298287635, 0.001511162253 };
+  static double const q1[5] = { 1.0, -0.3388260629, 0.09594393323, -0.01608042283, 0.003778942063 };
+  static double const p2[5] = { 0.1788541609, 0.1173957403, 0.01488850518, -0.001394989411, 0.0001283617211 };
+  static double const q2[5] = { 1.0, 0.7428795082, 0.3153932961, 0.06694219548, 0.008790609714 };
+  static double const p3[5] = { 0.1788544503, 0.09359161662, 0.006325387654, 0.00006611667319, -0.000002031049101 };
+  static double const q3[5] = { 1.0, 0.6097809921, 0.2560616665, 0.04746722384, 0.006957301675 };
+  static double const p4[5] = { 0.9874054407, 118.6723273, 849.2794360, -743.7792444, 427.0262186 };
+  static double const q4[5] = { 1.0, 106.8615961, 337.6496214, 2016.712389, 1597.063511 };
+  static double const p5[5] = { 1.003675074, 167.5702434, 4789.711289, 21217.86767, -22324.94910 };
+  static double const q5[5] = { 1.0, 156.9424537, 3745.310488, 9834.698876, 66924.28357 };
+  static double const p6[5] = { 1.000827619, 664.9143136, 62972.92665, 475554.6998, -5743609.109 };
+  static double const q6[5] = { 1.0, 651.4101098, 56974.73333, 165917.4725, -2815759.939 };
+  static double const a1[3] = { 0.04166666667, -0.01996527778, 0.02709538966 };
+  static double const a2[2] = { -1.845568670, -4.284640743 };
+  auto const ratio = [](double const * p, double const * q, double t){
+    return (p[0] + (p[1] + (p[2] + (p[3] + p[4] * t) * t) * t) * t)
+         / (q[0] + (q[1] + (q[2] + (q[3] + q[4] * t) * t) * t) * t);
+  };
+
+  if(xi <= 0.) return 0.;
+  double const v = (x - x0) / xi;
+  double density;
+  if(v < -5.5){
+    double const u = std::exp(v + 1.);
+    if(u < 1e-10) return 0.;
+    density = 0.3989422803 * (std::exp(-1. / u) / std::sqrt(u)) * (1. + (a1[0] + (a1[1] + a1[2] * u) * u) * u);
+  }
+  else if(v < -1.){
+    double const u = std::exp(-v - 1.);
+    density = std::exp(-u) * std::sqrt(u) * ratio(p1, q1, v);
+  }
+  else if(v < 1.) density = ratio(p2, q2, v);
+  else if(v < 5.) density = ratio(p3, q3, v);
+  else if(v < 12.){ double const u = 1. / v; density = u * u * ratio(p4, q4, u); }
+  else if(v < 50.){ double const u = 1. / v; density = u * u * ratio(p5, q5, u); }
+  else if(v < 300.){ double const u = 1. / v; density = u * u * ratio(p6, q6, u); }
+  else{
+    double const u = 1. / (v - v * std::log(v) / (v + 1.));
+    density = u * u * (1. + (a2[0] + a2[1] * u) * u);
+  }
+  return density / xi;
+}
+
+namespace {
+
+  constexpr double kLandauModeShift = -0.22278298; // mode of the standard Landau density
+  constexpr double kInvSqrt2Pi = 0.3989422804014327;
+
+}
+
+double test::LangausPdf(double x, double mpv, double width, double sigma, int nSteps)
+{
+  double const x0 = mpv - kLandauModeShift * width;
+  double const low = x - 5. * sigma, step = 10. * sigma / nSteps;
+  double sum = 0.;
+  for(int i = 0; i < nSteps; i++){
+    double const t = low + (i + 0.5) * step;
+    double const z = (x - t) / sigma;
+    sum += LandauPdf(t, x0, width) * std::exp(-0.5 * z * z);
+  }
+  return sum * step * kInvSqrt2Pi / sigma;
+}
+
+namespace {
+
+  // Fit parameters: mpv, ln(width), ln(sigma), ln(area), so that the
+  // scales stay positive without bounds
+  constexpr int kNPars = 4;
+
+  struct FitData {
+    std::vector<double> x;  // centres of the (contiguous) bins in the fit range
+    std::vector<double> y;  // counts
+    std::vector<double> w;  // 1 / variance (Neyman: counts, at least 1)
+    double binWidth;
+    int nSteps;             // convolution points over +- 5 sigma
+    // Work buffers of Model
+    std::vector<double> landau, kernel;
+  };
+
+  // Expected counts of every bin at once. The Landau density is evaluated
+  // once on a grid through the bin centres, fine enough for nSteps points
+  // over +- 5 sigma, and convolved there with the sampled Gaussian: each
+  // density value serves every bin within 5 sigma instead of being
+  // recomputed per bin.
+  void Model(FitData & data, double const * par, double * model)
+  {
+    double const width = std::exp(par[1]), sigma = std::exp(par[2]), area = std::exp(par[3]);
+    int const n = data.x.size();
+    int const perBin = std::min(64, std::max(1, int(std::ceil(data.binWidth * data.nSteps / (10. * sigma)))));
+    double const h = data.binWidth / perBin;
+    int const half = std::min(4096, std::max(1, int(std::ceil(5. * sigma / h))));
+
+    data.kernel.resize(2 * half + 1);
+    double norm = 0.;
+    for(int j = -half; j <= half; j++){
+      double const z = j * h / sigma;
+      norm += data.kernel[j + half] = std::exp(-0.5 * z * z);
+    }
+
+    double const x0 = par[0] - kLandauModeShift * width;
+    int const nGrid = (n - 1) * perBin + 2 * half + 1;
+    double const first = data.x.front() - half * h;
+    data.landau.resize(nGrid);
+    for(int g = 0; g < nGrid; g++) data.landau[g] = test::LandauPdf(first + g * h, x0, width);
+
+    double const scale = area * data.binWidth / norm;
+    for(int i = 0; i < n; i++){
+      double const * l = &data.landau[i * perBin];
+      double sum = 0.;
+      for(int j = 0; j <= 2 * half; j++) sum += l[j] * data.kernel[j];
+      model[i] = scale * sum;
+    }
+  }
+
+  double Chi2(FitData & data, double const * par, std::vector<double> & model)
+  {
+    Model(data, par, model.data());
+    double chi2 = 0.;
+    for(std::size_t i = 0; i < data.x.size(); i++){
+      double const r = data.y[i] - model[i];
+      chi2 += data.w[i] * r * r;
+    }
+    return chi2;
+  }
+
+  // Solve a x = b by Gaussian elimination with partial pivoting; false if singular
+  bool Solve(double a[kNPars][kNPars], double * b, double * x)
+  {
+    for(int c = 0; c < kNPars; c++){
+      int pivot = c;
+      for(int r = c + 1; r < kNPars; r++) if(std::fabs(a[r][c]) > std::fabs(a[pivot][c])) pivot = r;
+      if(a[pivot][c] == 0.) return false;
+      if(pivot != c){
+        for(int k = 0; k < kNPars; k++) std::swap(a[c][k], a[pivot][k]);
+        std::swap(b[c], b[pivot]);
+      }
+      for(int r = c + 1; r < kNPars; r++){
+        double const f = a[r][c] / a[c][c];
+        for(int k = c; k < kNPars; k++) a[r][k] -= f * a[c][k];
+        b[r] -= f * b[c];
+      }
+    }
+    for(int r = kNPars - 1; r >= 0; r--){
+      double s = b[r];
+      for(int k = r + 1; k < kNPars; k++) s -= a[r][k] * x[k];
+      x[r] = s / a[r][r];
+    }
+    return true;
+  }
+
+}
+
+test::LangausFitResult test::FitLangaus(unsigned long const * counts, int nbins, double xmin, double xmax,
+                                        LangausFitConfig const & config)
+{
+  LangausFitResult result;
+  if(nbins < 1) return result;
+  double const binWidth = (xmax - xmin) / nbins;
+  int const mode = std::max_element(counts, counts + nbins) - counts;
+  double const peak = xmin + (mode + 0.5) * binWidth;
+
+  FitData data;
+  data.binWidth = binWidth;
+  data.nSteps = config.convolutionSteps;
+  for(int i = 0; i < nbins; i++){
+    double const x = xmin + (i + 0.5) * binWidth;
+    if(x < config.rangeLow * peak || x > config.rangeHigh * peak) continue;
+    data.x.push_back(x);
+    data.y.push_back(counts[i]);
+    data.w.push_back(1. / std::max(1., double(counts[i])));
+    result.entries += counts[i];
+  }
+  int const n = data.x.size();
+  if(result.entries < config.minEntries || n <= kNPars) return result;
+
+  // Start: mpv at the mode, width and sigma from the full width at half maximum
+  double const half = 0.5 * counts[mode];
+  int lo = mode, hi = mode;
+  while(lo > 0 && counts[lo - 1] > half) lo--;
+  while(hi < nbins - 1 && counts[hi + 1] > half) hi++;
+  double const fwhm = std::max(1., double(hi - lo + 1)) * binWidth;
+  double par[kNPars] = { peak, std::log(fwhm / 8.), std::log(fwhm / 8.), std::log(double(result.entries)) };
+
+  std::vector<double> model(n), trial(n), shiftedModel(n);
+  std::vector<double> jac(n * kNPars);
+  double chi2 = Chi2(data, par, model);
+  double lambda = 1e-3;
+  double alpha[kNPars][kNPars] = {};
+  for(result.iterations = 0; result.iterations < config.maxIterations; result.iterations++){
+    // Jacobian by forward differences
+    for(int k = 0; k < kNPars; k++){
+      double shifted[kNPars];
+      std::copy(par, par + kNPars, shifted);
+      double const h = 1e-5 * std::max(1., std::fabs(par[k]));
+      shifted[k] += h;
+      Model(data, shifted, shiftedModel.data());
+      for(int i = 0; i < n; i++) jac[i * kNPars + k] = (shiftedModel[i] - model[i]) / h;
+    }
+    double beta[kNPars] = { 0., 0., 0., 0. };
+    for(int a = 0; a < kNPars; a++){
+      for(int b = 0; b < kNPars; b++) alpha[a][b] = 0.;
+    }
+    for(int i = 0; i < n; i++){
+      double const r = data.y[i] - model[i];
+      for(int a = 0; a < kNPars; a++){
+        beta[a] += data.w[i] * jac[i * kNPars + a] * r;
+        for(int b = 0; b <= a; b++) alpha[a][b] += data.w[i] * jac[i * kNPars + a] * jac[i * kNPars + b];
+      }
+    }
+    for(int a = 0; a < kNPars; a++){
+      for(int b = a + 1; b < kNPars; b++) alpha[a][b] = alpha[b][a];
+    }
+
+    // Damped steps until one lowers the chi2
+    bool improved = false;
+    double trialChi2 = chi2;
+    for(int attempt = 0; attempt < 20 && !improved; attempt++){
+      double damped[kNPars][kNPars], rhs[kNPars], step[kNPars];
+      for(int a = 0; a < kNPars; a++){
+        for(int b = 0; b < kNPars; b++) damped[a][b] = alpha[a][b] * (a == b ? 1. + lambda : 1.);
+        rhs[a] = beta[a];
+      }
+      if(!Solve(damped, rhs, step)){
+        lambda *= 10.;
+        continue;
+      }
+      double next[kNPars];
+      for(int k = 0; k < kNPars; k++) next[k] = par[k] + step[k];
+      trialChi2 = Chi2(data, next, trial);
+      if(trialChi2 < chi2){
+        std::copy(next, next + kNPars, par);
+        model.swap(trial);
+        improved = true;
+        lambda = std::max(1e-7, lambda / 10.);
+      }
+      else lambda *= 10.;
+    }
+    if(!improved) break;
+    double const change = chi2 - trialChi2;
+    chi2 = trialChi2;
+    if(change < 1e-6 * std::max(1., chi2)) break;
+  }
+
+  // Parameter errors from the inverse of the curvature matrix at the minimum
+  double covariance[kNPars][kNPars];
+  for(int k = 0; k < kNPars; k++){
+    double a[kNPars][kNPars], unit[kNPars] = { 0., 0., 0., 0. };
+    for(int r = 0; r < kNPars; r++){
+      for(int c = 0; c < kNPars; c++) a[r][c] = alpha[r][c];
+    }
+    unit[k] = 1.;
+    double column[kNPars];
+    if(!Solve(a, unit, column)) return result;
+    for(int r = 0; r < kNPars; r++) covariance[r][k] = column[r];
+  }
+
+  result.mpv = par[0];
+  result.width = std::exp(par[1]);
+  result.sigma = std::exp(par[2]);
+  result.area = std::exp(par[3]);
+  result.mpvError = std::sqrt(std::max(0., covariance[0][0]));
+  result.widthError = result.width * std::sqrt(std::max(0., covariance[1][1]));
+  result.sigmaError = result.sigma * std::sqrt(std::max(0., covariance[2][2]));
+  result.chi2 = chi2;
+  result.ndf = n - kNPars;
+  result.valid = std::isfinite(chi2) && result.mpv > data.x.front() && result.mpv < data.x.back();
+  return result;
+}
@@ -0,0 +1,52 @@
+////////////////////////////////////////////////////////////////////////
+// File:        LangausFit.h
+//
+// Landau convolved with a Gaussian, the usual model of the dQ/dx of
+// minimum ionising tracks (energy-loss fluctuations smeared by the
+// electronics noise), and its binned fit. Plain C++ with no global
+// state, so fits of different histograms can run concurrently: the
+// Landau density is the CERNLIB DENLAN approximation, the convolution a
+// midpoint sum over +- 5 Gaussian sigmas (in the fit, on a grid shared by
+// all bins), and the minimiser Levenberg-Marquardt on the Neyman chi2
+// with numerical derivatives.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_LANGAUSFIT_H
+#define MYPDDPTESTANA_LANGAUSFIT_H
+
+namespace test {
+
+  // Landau density of location x0 and scale xi (x0 is not the most
+  // probable value: that is x0 - 0.22278 xi)
+  double LandauPdf(double x, double x0, double xi);
+
+  // Normalised Landau (most probable value mpv, scale width) convolved
+  // with a Gaussian of sigma; nSteps points in the convolution
+  double LangausPdf(double x, double mpv, double width, double sigma, int nSteps = 64);
+
+  struct LangausFitConfig {
+    // Fit range as fractions of the histogram's most populated bin centre
+    double rangeLow = 0.5, rangeHigh = 3.;
+    int convolutionSteps = 64;
+    int maxIterations = 100;
+    unsigned long minEntries = 500; // histograms with fewer entries in the range are not fitted
+  };
+
+  struct LangausFitResult {
+    bool valid = false;
+    unsigned long entries = 0; // in the fit range
+    double mpv = 0., mpvError = 0.;      // Landau most probable value
+    double width = 0., widthError = 0.;  // Landau scale
+    double sigma = 0., sigmaError = 0.;  // Gaussian smearing
+    double area = 0.;                    // fitted counts
+    double chi2 = 0.;
+    int ndf = 0;
+    int iterations = 0;
+  };
+
+  // Fit counts[0..nbins) of uniform bins over [xmin, xmax)
+  LangausFitResult FitLangaus(unsigned long const * counts, int nbins, double xmin, double xmax,
+                              LangausFitConfig const & config = LangausFitConfig());
+
+}
+
+#endif
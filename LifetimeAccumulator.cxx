@@ -0,0 +1,123 @@
+////////////////////////////////////////////////////////////////////////
+// File:        LifetimeAccumulator.cxx
+////////////////////////////////////////////////////////////////////////
+#include "LifetimeAccumulator.h"
+
+#include <cmath>
+#include <stdexcept>
+
+void test::LifetimeAccumulator::Configure(LifetimeConfig const & config)
+{
+  fConfig = config;
+  if(fConfig.enable){
+    if(fConfig.nTimeBins < 1 || !(fConfig.tMax > fConfig.tMin)){
+      throw std::runtime_error("LifetimeAccumulator: NTimeBins must be positive and TimeMax above TimeMin");
+    }
+    if(fConfig.nChargeBins < 1 || !(fConfig.qMax > 0.)){
+      throw std::runtime_error("LifetimeAccumulator: NChargeBins and ChargeMax must be positive");
+    }
+    if(fConfig.source == LifetimeConfig::kX && !(fConfig.driftVelocity > 0.)){
+      throw std::runtime_error("LifetimeAccumulator: DriftVelocity must be positive");
+    }
+    if(fConfig.source == LifetimeConfig::kPeakTime && !(fConfig.tickPeriod > 0.)){
+      throw std::runtime_error("LifetimeAccumulator: TickPeriod must be positive");
+    }
+    if(!(fConfig.truncLow >= 0. && fConfig.truncLow < fConfig.truncHigh && fConfig.truncHigh <= 1.)){
+      throw std::runtime_error("LifetimeAccumulator: expected 0 <= TruncatedLow < TruncatedHigh <= 1");
+    }
+  }
+  fTimeScale = fConfig.nTimeBins / (fConfig.tMax - fConfig.tMin);
+  fChargeScale = fConfig.nChargeBins / fConfig.qMax;
+  fCounts.assign(fConfig.enable ? fConfig.nTimeBins * (fConfig.nChargeBins + 1) : 0, 0);
+}
+
+void test::LifetimeAccumulator::Merge(LifetimeAccumulator const & other)
+{
+  for(std::size_t i = 0; i < fCounts.size() && i < other.fCounts.size(); i++) fCounts[i] += other.fCounts[i];
+}
+
+double test::LifetimeAccumulator::Quantile(unsigned long const * counts, unsigned long n, double q) const
+{
+  // Linear interpolation inside the charge bin; the overflow bin reads as qMax
+  double const target = q * n;
+  double cumulative = 0.;
+  double const width = fConfig.qMax / fConfig.nChargeBins;
+  for(int iq = 0; iq <= fConfig.nChargeBins; iq++){
+    if(cumulative + counts[iq] >= target && counts[iq]){
+      if(iq == fConfig.nChargeBins) return fConfig.qMax;
+      return width * (iq + (target - cumulative) / counts[iq]);
+    }
+    cumulative += counts[iq];
+  }
+  return fConfig.qMax;
+}
+
+std::vector<test::LifetimeBin> test::LifetimeAccumulator::Bins() const
+{
+  std::vector<LifetimeBin> bins;
+  if(!Enabled()) return bins;
+  int const stride = fConfig.nChargeBins + 1;
+  double const width = fConfig.qMax / fConfig.nChargeBins;
+  for(int it = 0; it < fConfig.nTimeBins; it++){
+    unsigned long const * counts = &fCounts[it * stride];
+    LifetimeBin bin{ fConfig.tMin + (it + 0.5) / fTimeScale, 0, 0., 0., 0. };
+    for(int iq = 0; iq < stride; iq++) bin.n += counts[iq];
+    if(bin.n){
+      bin.median = Quantile(counts, bin.n, 0.5);
+      // Error on the median from the interquartile range: 1.2533 sigma / sqrt(n), sigma = IQR / 1.349
+      double const iqr = Quantile(counts, bin.n, 0.75) - Quantile(counts, bin.n, 0.25);
+      bin.medianError = 1.2533 * (iqr / 1.349) / std::sqrt(double(bin.n));
+      // Truncated mean over the [truncLow, truncHigh] quantile range, bin centres as values
+      double const lo = fConfig.truncLow * bin.n, hi = fConfig.truncHigh * bin.n;
+      double cumulative = 0., sum = 0., weight = 0.;
+      for(int iq = 0; iq < stride; iq++){
+        double const a = std::fmax(cumulative, lo), b = std::fmin(cumulative + counts[iq], hi);
+        if(b > a){
+          sum += (b - a) * width * (iq + 0.5);
+          weight += b - a;
+        }
+        cumulative += counts[iq];
+      }
+      bin.truncatedMean = weight > 0. ? sum / weight : 0.;
+    }
+    bins.push_back(bin);
+  }
+  return bins;
+}
+
+test::LifetimeFit test::LifetimeAccumulator::Fit(std::vector<LifetimeBin> const & bins) const
+{
+  // Weighted least squares of ln(median) = ln(q0) - t / tau
+  double s = 0., sx = 0., sy = 0., sxx = 0., sxy = 0.;
+  int n = 0;
+  for(LifetimeBin const & bin : bins){
+    if(bin.n < fConfig.minEntries || bin.median <= 0. || bin.medianError <= 0.) continue;
+    double const y = std::log(bin.median);
+    double const w = std::pow(bin.median / bin.medianError, 2); // 1 / sigma(ln median)^2
+    s += w; sx += w * bin.t; sy += w * y; sxx += w * bin.t * bin.t; sxy += w * bin.t * y;
+    n++;
+  }
+
+  LifetimeFit fit;
+  double const det = s * sxx - sx * sx;
+  if(n < 3 || det <= 0.) return fit;
+  double const slope = (s * sxy - sx * sy) / det;
+  double const intercept = (sxx * sy - sx * sxy) / det;
+  double const slopeError = std::sqrt(s / det);
+  double const interceptError = std::sqrt(sxx / det);
+
+  for(LifetimeBin const & bin : bins){
+    if(bin.n < fConfig.minEntries || bin.median <= 0. || bin.medianError <= 0.) continue;
+    double const r = (std::log(bin.median) - intercept - slope * bin.t) * bin.median / bin.medianError;
+    fit.chi2 += r * r;
+  }
+  fit.ndf = n - 2;
+  fit.q0 = std::exp(intercept);
+  fit.q0Error = fit.q0 * interceptError;
+  if(slope < 0.){
+    fit.valid = true;
+    fit.tau = -1. / slope;
+    fit.tauError = slopeError / (slope * slope);
+  }
+  return fit;
+}
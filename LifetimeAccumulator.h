@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       LifetimeAccumulator
+// File:        LifetimeAccumulator.h
+//
+// Streaming electron-lifetime measurement for the dual-phase purity
+// monitoring. Calorimetry points of the selected muon tracks are binned
+// in drift time; each drift bin keeps a fine dQ/dx histogram, from
+// which robust statistics (median, truncated mean) are read. The
+// histograms merge exactly across schedules, and the exponential
+// attenuation of the median is fitted at the end of the job.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_LIFETIMEACCUMULATOR_H
+#define MYPDDPTESTANA_LIFETIMEACCUMULATOR_H
+
+#include <vector>
+
+namespace test {
+
+  struct LifetimeConfig {
+    enum DriftSource { kPeakTime, kX };
+
+    bool enable = false;
+    DriftSource source = kX;
+    int plane = -1;               // plane used, -1 for all
+    // Drift-time binning [us]
+    int nTimeBins = 40;
+    double tMin = 0., tMax = 4000.;
+    // dQ/dx binning of each drift bin [fC/cm]
+    int nChargeBins = 400;
+    double qMax = 20.;
+    // Drift time from the hit peak time: t = (PeakTime - triggerTick) * tickPeriod
+    double tickPeriod = 0.4;      // [us]
+    double triggerTick = 0.;
+    // Drift time from the point position: t = (anodeX - x) / driftVelocity
+    double anodeX = 300.;         // [cm]
+    double driftVelocity = 0.16;  // [cm/us]
+    // Truncated mean: quantile range kept
+    double truncLow = 0.05, truncHigh = 0.6;
+    // Bins with fewer entries are not fitted
+    unsigned long minEntries = 50;
+  };
+
+  struct LifetimeBin {
+    double t;              // bin centre [us]
+    unsigned long n;
+    double median;         // [fC/cm]
+    double medianError;
+    double truncatedMean;  // [fC/cm]
+  };
+
+  struct LifetimeFit {
+    bool valid = false;
+    double tau = 0., tauError = 0.;  // [us]
+    double q0 = 0., q0Error = 0.;    // median dQ/dx at t = 0 [fC/cm]
+    double chi2 = 0.;
+    int ndf = 0;
+  };
+
+  class LifetimeAccumulator {
+  public:
+    // Throws std::runtime_error, when enabled, on empty binning, a
+    // non-positive drift velocity (or tick period, for kPeakTime), or
+    // truncation fractions outside 0 <= truncLow < truncHigh <= 1
+    void Configure(LifetimeConfig const & config);
+    LifetimeConfig const & Config() const { return fConfig; }
+    bool Enabled() const { return fConfig.enable; }
+
+    double DriftTimeFromTick(double peakTime) const { return (peakTime - fConfig.triggerTick) * fConfig.tickPeriod; }
+    double DriftTimeFromX(double x) const { return (fConfig.anodeX - x) / fConfig.driftVelocity; }
+
+    void Add(double driftTime, double dQdx)
+    {
+      if(!(driftTime >= fConfig.tMin && driftTime < fConfig.tMax)) return;
+      int it = int((driftTime - fConfig.tMin) * fTimeScale);
+      if(it >= fConfig.nTimeBins) it = fConfig.nTimeBins - 1; // rounding just below tMax
+      int iq = dQdx > 0. ? int(dQdx * fChargeScale) : 0;
+      if(iq >= fConfig.nChargeBins) iq = fConfig.nChargeBins; // overflow bin
+      fCounts[it * (fConfig.nChargeBins + 1) + iq]++;
+    }
+
+    void Merge(LifetimeAccumulator const & other);
+
+    // Robust statistics per drift bin, and the exponential fit of the medians
+    std::vector<LifetimeBin> Bins() const;
+    LifetimeFit Fit(std::vector<LifetimeBin> const & bins) const;
+
+  private:
+    double Quantile(unsigned long const * counts, unsigned long n, double q) const;
+
+    LifetimeConfig fConfig;
+    double fTimeScale = 0.;   // bins per us
+    double fChargeScale = 0.; // bins per fC/cm
+    std::vector<unsigned long> fCounts; // [time bin][charge bin + overflow]
+  };
+
+}
+
+#endif
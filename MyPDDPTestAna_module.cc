@@ -6,22 +6,36 @@
 // Generated at Tue Oct  8 14:37:54 2019 by Raphaël Bajou,,, using artmod
 // from cetpkgsupport v1_14_01.
 ////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <stdlib.h>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "art/Framework/Core/EDProducer.h"
-#include "art/Framework/Core/EDAnalyzer.h"
+#include "art/Framework/Core/SharedAnalyzer.h"
 #include "art/Framework/Core/ModuleMacros.h"
+#include "art/Framework/Core/ProcessingFrame.h"
 #include "art/Framework/Principal/Event.h"
 #include "art/Framework/Principal/Handle.h"
 #include "art/Framework/Principal/Run.h"
 #include "art/Framework/Principal/SubRun.h"
+#include "art/Utilities/PerScheduleContainer.h"
 #include "fhiclcpp/ParameterSet.h"
 #include "messagefacility/MessageLogger/MessageLogger.h"
 #include "art_root_io/TFileService.h"
+#include "canvas/Persistency/Common/Assns.h"
+#include "canvas/Persistency/Common/FindMany.h"
 #include "canvas/Persistency/Common/FindManyP.h"
+#include "canvas/Utilities/Exception.h"
 #include "canvas/Utilities/InputTag.h"
 
 #include "lardataobj/RecoBase/PFParticle.h"
@@ -29,16 +43,46 @@
 #include "lardataobj/RecoBase/Hit.h"
 #include "lardataobj/RecoBase/Track.h"
 #include "lardataobj/RecoBase/SpacePoint.h"
-#include "lardataobj/RecoBase/TrackHitMeta.h"
 
+#include "tbb/enumerable_thread_specific.h"
+#include "tbb/parallel_for.h"
+
+#include "Compression.h"
+#include "TBranch.h"
+#include "TDirectory.h"
+#include "TFile.h"
+#include "TObjArray.h"
 #include "TTree.h"
 #include "TH1D.h"
+#include "TH2D.h"
+
+#include "AnaCore.h"
+#include "AsyncRecordWriter.h"
+#include "BranchSelection.h"
+#include "EventRecord.h"
+#include "GainTable.h"
+#include "PhaseTimer.h"
+#include "RecordArena.h"
+#include "ReducedPrecision.h"
 
 namespace test {
   class MyPDDPTestAna;
 }
 
-class test::MyPDDPTestAna : public art::EDAnalyzer {
+namespace {
+  // ROOT leaf list "name/T" of a scalar branch, from its C++ type
+  template <typename T>
+  std::string LeafList(char const * name)
+  {
+    if constexpr(std::is_same_v<T, unsigned int>) return std::string(name) + "/i";
+    else if constexpr(std::is_same_v<T, int>) return std::string(name) + "/I";
+    else if constexpr(std::is_same_v<T, float>) return std::string(name) + "/F";
+    else if constexpr(std::is_same_v<T, double>) return std::string(name) + "/D";
+    else static_assert(!sizeof(T), "no ROOT leaf type for this scalar");
+  }
+}
+
+class test::MyPDDPTestAna : public art::SharedAnalyzer {
 public:
   explicit MyPDDPTestAna(fhicl::ParameterSet const & p);
   // The destructor generated by the compiler is fine for classes
@@ -51,54 +95,230 @@ public:
   MyPDDPTestAna & operator = (MyPDDPTestAna &&) = delete;
 
   // Required functions.
-  void analyze(art::Event const & e) override;
-  void beginJob();
-  void endJob();
+  void analyze(art::Event const & e, art::ProcessingFrame const & frame) override;
+  void beginJob(art::ProcessingFrame const & frame) override;
+  void endJob(art::ProcessingFrame const & frame) override;
 
 private:
+
+  // Products and associations the module can read. Which ones are actually
+  // read is decided once in the constructor (the "products plan").
+  enum Product {
+    kPFParticles, kTracks,
+    kPFPTrackAssns, kPFPSpacePointAssns, kTrackHitAssns, kCalorimetryAssns,
+    kNProducts
+  };
+  static constexpr std::array<const char*, kNProducts> kProductNames = {{
+    "PFParticles", "Tracks",
+    "PFParticle-Track", "PFParticle-SpacePoint", "Track-Hit", "Track-Calorimetry"
+  }};
+
+  bool Reads(Product prod) const { return fPlan[prod]; }
+
+  // Phases of analyze() timed when PhaseTiming is enabled
+  enum Phase { kPhaseProducts, kPhaseAssociations, kPhaseLoops, kPhaseFill, kNPhases };
+  static constexpr std::array<const char*, kNPhases> kPhaseNames = {{
+    "GetProducts", "Associations", "Loops", "TreeFill"
+  }};
+
+  // One selected track and its association results
+  struct TrackInput {
+    recob::Track const * track;
+    std::vector< recob::Hit const * > const * hits;
+    std::vector< anab::Calorimetry const * > const * calos;
+  };
+
+  // Views and record of one track on the parallel path
+  struct TrackPartial {
+    std::vector<HitView> hitViews;
+    std::vector<CaloView> caloViews;
+    EventRecord record; // on the default resource, keeps its capacity from event to event
+  };
+
+  // Everything a schedule writes to while processing an event
+  struct ScheduleData {
+    RecordArena arena;  // backs the columns of record, declared first to outlive it
+    EventRecord record;
+    AnaAccumulators acc; // dQ/dx histogram partial, lifetime accumulator
+    std::array<unsigned long, kNProducts> nReads{}; // events in which each product was read
+    PhaseTimer timer;
+
+    // View buffers handed to the core, reused from track to track
+    std::vector<PFParticleView> pfpViews;
+    std::vector<HitView> hitViews;
+    std::vector<CaloView> caloViews;
+    std::vector<std::size_t> selected;
+    std::vector<TrackInput> trackInputs; // selected tracks of the event, in output order
+    std::vector<TrackPartial> partials;  // grown to the largest parallel multiplicity
+    unsigned long nParallelEvents = 0;   // events whose tracks ran as parallel tasks
+
+    // Inputs of the selection-first associations, reused from event to event
+    std::vector< art::Ptr<recob::PFParticle> > muonlist;
+    std::vector< art::Ptr<recob::Track> > selectedtracks;
+  };
+
+  // Build the views of one track of a selected muon in the given buffers.
+  // The hits and calorimetry come straight from the association results,
+  // by reference and as bare pointers.
+  TrackView MakeTrackView(TrackInput const & input,
+                          std::vector<HitView> & hitViews,
+                          std::vector<CaloView> & caloViews) const;
+
+  // Pass data.trackInputs to the core: one after the other, or from
+  // ParallelTrackThreshold tracks on as TBB tasks into per-track partial
+  // records, appended in track order (same record as the serial path)
+  void ProcessTracks(ScheduleData & data) const;
+
+  // Single serialization point for all writes to fOutputFile: hands the
+  // record to the writer thread, or fills it here under fTreeMutex
+  void WriteRecord(EventRecord const & record);
+
+  // Encode the reduced-precision branches of fTreeRecord and fill fOutputTree,
+  // and the hits and points trees with SplitTrees
+  void FillTree();
+
+  // One hits and one points entry per track of fTreeRecord, from its offsets
+  void FillTrackTrees();
+
+  // Encode the reduced-precision branches of one tree
+  void EncodeBranches(TTree * tree);
+
+  // Tree of a schema entry: mytree, or with SplitTrees the hits and points
+  // trees for the per-hit and per-point columns; none for the offset
+  // columns, which the (Entry, Track) keys replace there
+  enum TreeSlot { kMainTree, kHitTree, kPointTree, kNoTree };
+  TreeSlot EntryTree(RecordField f) const;
+  TreeSlot PlaneEntryTree(RecordPlaneField f) const
+  {
+    return fSplitTrees && kRecordPlaneFieldLengths[f] == RecordLength::points ? kPointTree : kMainTree;
+  }
+  TTree * SlotTree(TreeSlot slot) const
+  {
+    return slot == kMainTree ? fOutputTree : slot == kHitTree ? fHitTree : slot == kPointTree ? fPointTree : nullptr;
+  }
+  // Branch buffers of a tree: fTreeRecord, or fTrackSlice for the split trees
+  TreeRecord & TreeBuffers(TTree * tree) { return tree == fOutputTree ? fTreeRecord : fTrackSlice; }
+
+  // Apply the OutputTree compression, basket and flush settings to fOutputTree
+  void ConfigureOutputTree();
+
+  // Set hist to the sum of the per-schedule partials
+  static void MergeHist(TH1D * hist, std::vector<HistPartial const *> const & partials);
+
+  // Fit the merged lifetime accumulator and write the per-bin statistics and the result
+  void WriteLifetime(LifetimeAccumulator const & lifetime);
+
+  // Fit the Bragg-region MPVs of the merged stopping-muon accumulator and
+  // write them with the dQ/dx versus residual range histograms
+  void WriteStoppingMuons(StoppingMuonAccumulator const & stopping);
+
+  // Fit every histogram of the merged charge-fit accumulator, one task per
+  // histogram, and write the MPVs, widths and chi2s
+  void WriteChargeFits(ChargeFitAccumulator const & fits);
+
+  // Write the populated voxels of the merged voxel charge map
+  void WriteVoxelCharge(VoxelChargeAccumulator const & voxels);
+
+  // Print the phase latency percentiles, and write them out if requested
+  void ReportPhaseTiming(PhaseTimer const & timer);
+
+  // Branch a double column either directly or through its configured reduced precision
+  void BranchDouble(TTree * tree, const char * name, std::vector< double > TreeRecord::* column);
+
+  // Branch a schema column: BranchDouble for the double ones
+  template <typename T>
+  void BranchColumn(TTree * tree, const char * name, std::vector< T > TreeRecord::* column)
+  {
+    if constexpr(std::is_same_v<T, double>) BranchDouble(tree, name, column);
+    else tree->Branch(name, &(TreeBuffers(tree).*column));
+  }
   
   // Declare member data here.
+  // mytree and the split trees live in a file of their own, which no other
+  // module writes to: their fills need no art shared resource, and events
+  // stay concurrent (see WriteRecord)
+  std::unique_ptr<TFile> fOutputFile;
   TTree *fOutputTree;
+  TreeRecord fTreeRecord; // branch buffers, only touched under fTreeMutex or by the writer thread
+  RecordMask fRecordMask; // branches written to fOutputTree (and the split trees)
+  RecordMask fFillMask;   // entries filled and copied to fTreeRecord: fRecordMask plus the split-tree offsets
 
-  unsigned int fEventID;
-  unsigned int fNPFParticles;
-  unsigned int fNPrimaries;
-  int fNPrimaryDaughters;
-  int fNTracks;
-  std::vector< double > fTrackLength;
-  std::vector< int > fNHits;
-  std::vector< int > fView;
-  std::vector< double > fX, fStartX, fEndX; 
-  std::vector< double > fY, fStartY, fEndY;
-  std::vector< double > fZ, fStartZ, fEndZ;
-  std::vector< double > fStartTick;
-  std::vector< double > fPeakTime;
-  std::vector< double > fHitIntegral;
-  std::vector< double > fdQdx;
-  //  std::vector< double > fPeakTime0;
-  //  std::vector< double > fPeakTime1;
-  //std::vector< double > fHitIntegral0; 
-  //std::vector< double > fHitIntegral1; 
-  std::vector< float > fdQdx0;
-  std::vector< float > fdQdx1;
-  std::vector< int > fPlanenum;
+  // SplitTrees: per-hit and per-point columns in their own trees, one entry
+  // per track keyed by (Entry, Track), so that mytree only holds the event
+  // and track summary
+  bool fSplitTrees;
+  TTree *fHitTree = nullptr;
+  TTree *fPointTree = nullptr;
+  TreeRecord fTrackSlice; // one track's hit and point columns, branch buffers of the split trees
+  Long64_t fSplitEntry = 0; // mytree entry of the event; unique across runs and subruns, unlike its event ID
+  unsigned int fSplitTrack = 0;
+  std::vector< std::size_t > fPlaneCursor; // first point of each plane of the track being split
+  std::vector< std::size_t > fPlaneCount;  // points of each plane of the track being split
+  std::mutex fTreeMutex;
   TH1D *fdQdxhist;
+  std::vector<TH1D *> fPlanedQdxhist;
+  bool fHistograms; // hdQdx histograms enabled (hist.hdQdx)
+  int fHistBins;    // binning of the hdQdx histograms [fC/cm]
+  double fHistMin, fHistMax;
+
+  art::PerScheduleContainer<ScheduleData> fScheduleData;
 
   std::string fPFParticleLabel;
   std::string fTrackModuleLabel;
   std::string fSpacePointModuleLabel;
   std::string fCalorimetryLabel;
-  std::string fHitModuleLabel;
+
+  // Declared in the constructor so art can prefetch the inputs
+  art::ProductToken< std::vector<recob::PFParticle> > fPFParticleToken;
+  art::ProductToken< std::vector<recob::Track> > fTrackToken;
+
+  bool fSelectionFirst; // select primary muons before building the associations
+  bool fRequireSpacePoints; // primary muons must have associated space points
+  bool fColumnarOutput; // write the per-point columns and per-track offset arrays
+  int fNPlanes;         // readout planes with their own plane columns and hdQdx<plane> histogram
+  bool fAllHits;        // view every hit of a track, not only up to the first valid point
+
+  std::array<bool, kNProducts> fPlan; // products read by this job
+
+  fhicl::ParameterSet fOutputTreeConfig; // compression, basket sizes, auto-flush/save
+
+  bool fPhaseTiming;     // time the phases of analyze(), not only the whole event
+  bool fPhaseTimingTree; // also write the phase latency summary as a TTree
+  std::size_t fRecordArenaBytes; // initial size of each schedule's record arena
+  std::size_t fWriterDepth;      // records in flight to the writer thread, 0: fill in analyze()
+  std::size_t fParallelTrackThreshold; // events with this many selected tracks run them in parallel, 0: never
+
+  // Histograms and lifetime filled by the parallel track tasks, per thread
+  std::unique_ptr< tbb::enumerable_thread_specific<AnaAccumulators> > fTrackAccumulators;
+
+  // Double columns stored with reduced precision, encoded in FillTree
+  struct ReducedBranch {
+    std::string name;
+    TTree * tree;
+    std::vector< double > TreeRecord::* column; // of TreeBuffers(tree)
+    std::unique_ptr<ReducedPrecisionColumn> encoder;
+  };
+  std::vector<ReducedBranch> fReducedBranches;
   
-  //Constantes
-  float C = 89.1; //[ADC/fC] : calibration constante
+  AnaCore fCore; // selection, extraction and dQ/dx scaling
+  std::unique_ptr<GainTable> fGainTable; // per-channel / per-CRP gains, null: constant
+  LifetimeConfig fLifetimeConfig;
+  StoppingMuonConfig fStoppingConfig;
+  ChargeFitConfig fChargeFitConfig;
+  LangausFitConfig fLangausConfig;
+  bool fChargeFitHistograms; // also write the fitted histograms
+  VoxelChargeConfig fVoxelConfig;
+
+  // Fills fOutputTree from its own thread when AsyncWriterDepth > 0; last,
+  // so that it is stopped before the tree buffers it writes go away
+  std::unique_ptr<AsyncRecordWriter> fWriter;
   
 };
 
 
 test::MyPDDPTestAna::MyPDDPTestAna(fhicl::ParameterSet const & p)
   :
-  EDAnalyzer(p) 
+  SharedAnalyzer(p) 
 // Initialize member data here.
 {
   
@@ -107,175 +327,1139 @@ test::MyPDDPTestAna::MyPDDPTestAna(fhicl::ParameterSet const & p)
   fTrackModuleLabel      = p.get<std::string>("TrackModuleLabel");
   fSpacePointModuleLabel = p.get<std::string>("SpacePointModuleLabel");
   fCalorimetryLabel      = p.get<std::string>("CalorimetryLabel");
-  fHitModuleLabel        = p.get<std::string>("HitModuleLabel");
+  fSelectionFirst        = p.get<bool>("SelectionFirst", true);
+  fColumnarOutput        = p.get<bool>("ColumnarOutput", true);
+  fNPlanes               = p.get<int>("NPlanes", 2);
+  if(fNPlanes < 1){
+    throw art::Exception(art::errors::Configuration) << "NPlanes must be at least 1, got " << fNPlanes << "\n";
+  }
+  fOutputTreeConfig      = p.get<fhicl::ParameterSet>("OutputTree", fhicl::ParameterSet());
+  fPhaseTiming           = p.get<bool>("PhaseTiming", false);
+
+  // Branches written: OutputTree.Branches, minus the columnar ones when
+  // ColumnarOutput is off, minus OutputTree.DisabledBranches. What is not
+  // written is not computed either.
+  BranchSelection selection(fNPlanes);
+  try{
+    selection.Apply(fOutputTreeConfig.get< std::vector<std::string> >("Branches", { "*" }), fNPlanes);
+  }
+  catch(std::runtime_error const & e){
+    throw art::Exception(art::errors::Configuration) << "OutputTree.Branches: " << e.what() << "\n";
+  }
+  fRecordMask = selection.mask;
+  fHistograms = selection.histograms;
+  if(!fColumnarOutput){
+    for(RecordField f : { kRecordPointdQdx, kRecordPointPlane, kRecordTrackHitOffset, kRecordTrackPointOffset }){
+      fRecordMask.fields.reset(f);
+    }
+  }
+  for(std::string const & name : fOutputTreeConfig.get< std::vector<std::string> >("DisabledBranches", {})){
+    bool known = false;
+    for(int f = 0; f < kNRecordFields; f++){
+      if(name != kRecordFieldNames[f]) continue;
+      fRecordMask.fields.reset(f);
+      known = true;
+    }
+    for(int f = 0; f < kNRecordPlaneFields; f++){
+      for(int plane = 0; plane < fNPlanes; plane++){
+        if(name != kRecordPlaneFieldNames[f] + std::to_string(plane)) continue;
+        fRecordMask.planes[f][plane] = false;
+        known = true;
+      }
+    }
+    if(!known){
+      throw art::Exception(art::errors::Configuration)
+        << "OutputTree.DisabledBranches: no branch named '" << name << "' in mytree\n";
+    }
+  }
+
+  // Split trees: the core also fills the offsets of the columns moved out
+  // of mytree (and PointPlane, which splits the per-point plane columns by track)
+  fSplitTrees = fOutputTreeConfig.get<bool>("SplitTrees", false);
+  if(fSplitTrees && !fColumnarOutput){
+    throw art::Exception(art::errors::Configuration)
+      << "OutputTree.SplitTrees needs ColumnarOutput: the trees are split with the per-track offsets\n";
+  }
+  fFillMask = fRecordMask;
+  if(fSplitTrees){
+    for(int f = 0; f < kNRecordFields; f++){
+      if(!fRecordMask.Field(RecordField(f))) continue;
+      if(EntryTree(RecordField(f)) == kHitTree) fFillMask.fields.set(kRecordTrackHitOffset);
+      if(EntryTree(RecordField(f)) == kPointTree) fFillMask.fields.set(kRecordTrackPointOffset);
+    }
+    for(int f = 0; f < kNRecordPlaneFields; f++){
+      if(PlaneEntryTree(RecordPlaneField(f)) != kPointTree || !fRecordMask.AnyPlane(RecordPlaneField(f))) continue;
+      fFillMask.fields.set(kRecordTrackPointOffset);
+      fFillMask.fields.set(kRecordPointPlane);
+    }
+  }
+  fPhaseTimingTree       = p.get<bool>("PhaseTimingTree", false);
+  fRecordArenaBytes      = p.get<std::size_t>("RecordArenaBytes", std::size_t(1) << 20);
+  fWriterDepth           = p.get<std::size_t>("AsyncWriterDepth", 0);
+  fParallelTrackThreshold = p.get<std::size_t>("ParallelTrackThreshold", 0);
+
+  fhicl::ParameterSet const histogram = p.get<fhicl::ParameterSet>("dQdxHistogram", fhicl::ParameterSet());
+  fHistBins = histogram.get<int>("NBins", 50);
+  fHistMin  = histogram.get<double>("Min", 0.);
+  fHistMax  = histogram.get<double>("Max", 50.);
+  if(fHistBins < 1 || !(fHistMax > fHistMin)){
+    throw art::Exception(art::errors::Configuration)
+      << "dQdxHistogram: NBins must be positive and Max above Min, got " << fHistBins << " bins over ["
+      << fHistMin << ", " << fHistMax << "]\n";
+  }
+
+  AnaCoreConfig coreConfig;
+  coreConfig.calibConstant = 89.1; //[ADC/fC] : calibration constante
+  coreConfig.columnar      = fColumnarOutput;
+  coreConfig.fill          = fFillMask;
+  coreConfig.histograms    = fHistograms;
+  coreConfig.nPlanes       = fNPlanes;
+  fhicl::ParameterSet const charge = p.get<fhicl::ParameterSet>("TrackCharge", fhicl::ParameterSet());
+  coreConfig.charge.truncLow  = charge.get<double>("TruncatedLow", coreConfig.charge.truncLow);
+  coreConfig.charge.truncHigh = charge.get<double>("TruncatedHigh", coreConfig.charge.truncHigh);
+  coreConfig.charge.quantile  = charge.get<double>("Quantile", coreConfig.charge.quantile);
+  try{
+    coreConfig.simd = ParseSimdLevel(p.get<std::string>("SimdLevel", "auto"));
+  }
+  catch(std::runtime_error const & e){
+    throw art::Exception(art::errors::Configuration) << "SimdLevel: " << e.what() << "\n";
+  }
+  std::string const gainTable = p.get<std::string>("GainTable", "");
+  if(!gainTable.empty()){
+    try{
+      fGainTable = std::make_unique<GainTable>(gainTable);
+    }
+    catch(std::runtime_error const & e){
+      throw art::Exception(art::errors::Configuration) << "GainTable: " << e.what() << "\n";
+    }
+    coreConfig.gains = fGainTable.get();
+    mf::LogInfo("MyPDDPTestAna") << "Gain table " << gainTable << ": " << fGainTable->NEntries()
+                                 << " entries of " << fGainTable->ChannelsPerEntry() << " channel(s)";
+  }
+  try{
+    fCore = AnaCore(coreConfig);
+  }
+  catch(std::runtime_error const & e){
+    throw art::Exception(art::errors::Configuration) << e.what() << "\n";
+  }
+  mf::LogInfo("MyPDDPTestAna") << "Calorimetry batch kernels: " << SimdLevelName(fCore.KernelLevel());
+
+  // Streaming electron lifetime
+  fhicl::ParameterSet const lifetime = p.get<fhicl::ParameterSet>("Lifetime", fhicl::ParameterSet());
+  LifetimeConfig & lt = fLifetimeConfig;
+  lt.enable = lifetime.get<bool>("Enable", false);
+  std::string const source = lifetime.get<std::string>("DriftTimeSource", "X");
+  if(source == "X") lt.source = LifetimeConfig::kX;
+  else if(source == "PeakTime") lt.source = LifetimeConfig::kPeakTime;
+  else{
+    throw art::Exception(art::errors::Configuration)
+      << "Lifetime.DriftTimeSource: unknown source '" << source << "' (expected X or PeakTime)\n";
+  }
+  lt.plane         = lifetime.get<int>("Plane", lt.plane);
+  lt.nTimeBins     = lifetime.get<int>("NTimeBins", lt.nTimeBins);
+  lt.tMin          = lifetime.get<double>("TimeMin", lt.tMin);
+  lt.tMax          = lifetime.get<double>("TimeMax", lt.tMax);
+  lt.nChargeBins   = lifetime.get<int>("NChargeBins", lt.nChargeBins);
+  lt.qMax          = lifetime.get<double>("ChargeMax", lt.qMax);
+  lt.tickPeriod    = lifetime.get<double>("TickPeriod", lt.tickPeriod);
+  lt.triggerTick   = lifetime.get<double>("TriggerTick", lt.triggerTick);
+  lt.anodeX        = lifetime.get<double>("AnodeX", lt.anodeX);
+  lt.driftVelocity = lifetime.get<double>("DriftVelocity", lt.driftVelocity);
+  lt.truncLow      = lifetime.get<double>("TruncatedLow", lt.truncLow);
+  lt.truncHigh     = lifetime.get<double>("TruncatedHigh", lt.truncHigh);
+  lt.minEntries    = lifetime.get<unsigned long>("MinEntries", lt.minEntries);
+  try{
+    LifetimeAccumulator().Configure(lt);
+  }
+  catch(std::runtime_error const & e){
+    throw art::Exception(art::errors::Configuration) << "Lifetime: " << e.what() << "\n";
+  }
+
+  // Stopping muons: dQ/dx versus residual range, Bragg-region MPV fits
+  fhicl::ParameterSet const stopping = p.get<fhicl::ParameterSet>("StoppingMuon", fhicl::ParameterSet());
+  StoppingMuonConfig & sm = fStoppingConfig;
+  sm.enable         = stopping.get<bool>("Enable", false);
+  sm.nPlanes        = fNPlanes;
+  std::vector<double> const volume = stopping.get< std::vector<double> >("ActiveVolume", { sm.xMin, sm.xMax, sm.yMin, sm.yMax, sm.zMin, sm.zMax });
+  if(volume.size() != 6){
+    throw art::Exception(art::errors::Configuration)
+      << "StoppingMuon.ActiveVolume: expected [ xmin, xmax, ymin, ymax, zmin, zmax ], got " << volume.size() << " values\n";
+  }
+  sm.xMin = volume[0]; sm.xMax = volume[1];
+  sm.yMin = volume[2]; sm.yMax = volume[3];
+  sm.zMin = volume[4]; sm.zMax = volume[5];
+  sm.fiducialMargin = stopping.get<double>("FiducialMargin", sm.fiducialMargin);
+  sm.nRangeBins     = stopping.get<int>("NRangeBins", sm.nRangeBins);
+  sm.rangeMax       = stopping.get<double>("RangeMax", sm.rangeMax);
+  sm.nChargeBins    = stopping.get<int>("NChargeBins", sm.nChargeBins);
+  sm.qMax           = stopping.get<double>("ChargeMax", sm.qMax);
+  sm.minPitch       = stopping.get<double>("MinPitch", sm.minPitch);
+  sm.maxPitch       = stopping.get<double>("MaxPitch", sm.maxPitch);
+  sm.braggRangeMax  = stopping.get<double>("BraggRangeMax", sm.braggRangeMax);
+  sm.minEntries     = stopping.get<unsigned long>("MinEntries", sm.minEntries);
+  sm.fitHalfWidth   = stopping.get<int>("FitHalfWidth", sm.fitHalfWidth);
+  try{
+    StoppingMuonAccumulator().Configure(sm);
+  }
+  catch(std::runtime_error const & e){
+    throw art::Exception(art::errors::Configuration) << "StoppingMuon: " << e.what() << "\n";
+  }
+
+  // Landau-Gaussian MPV fits of dQ/dx histograms per plane, CRP and drift slice
+  fhicl::ParameterSet const chargeFits = p.get<fhicl::ParameterSet>("ChargeFits", fhicl::ParameterSet());
+  ChargeFitConfig & cf = fChargeFitConfig;
+  cf.enable         = chargeFits.get<bool>("Enable", false);
+  cf.sets           = chargeFits.get< std::vector<std::string> >("Sets", cf.sets);
+  cf.nPlanes        = fNPlanes;
+  cf.channelsPerCRP = chargeFits.get<unsigned int>("ChannelsPerCRP", cf.channelsPerCRP);
+  cf.nCRPs          = chargeFits.get<int>("NCRPs", cf.nCRPs);
+  cf.anodeX         = chargeFits.get<double>("AnodeX", cf.anodeX);
+  cf.driftVelocity  = chargeFits.get<double>("DriftVelocity", cf.driftVelocity);
+  cf.nDriftSlices   = chargeFits.get<int>("NDriftSlices", cf.nDriftSlices);
+  cf.tMin           = chargeFits.get<double>("TimeMin", cf.tMin);
+  cf.tMax           = chargeFits.get<double>("TimeMax", cf.tMax);
+  cf.nChargeBins    = chargeFits.get<int>("NChargeBins", cf.nChargeBins);
+  cf.qMax           = chargeFits.get<double>("ChargeMax", cf.qMax);
+  LangausFitConfig & lg = fLangausConfig;
+  lg.rangeLow         = chargeFits.get<double>("FitRangeLow", lg.rangeLow);
+  lg.rangeHigh        = chargeFits.get<double>("FitRangeHigh", lg.rangeHigh);
+  lg.convolutionSteps = chargeFits.get<int>("ConvolutionSteps", lg.convolutionSteps);
+  lg.maxIterations    = chargeFits.get<int>("MaxIterations", lg.maxIterations);
+  lg.minEntries       = chargeFits.get<unsigned long>("MinEntries", lg.minEntries);
+  fChargeFitHistograms = chargeFits.get<bool>("WriteHistograms", false);
+  if(cf.enable && !(cf.channelsPerCRP > 0 && cf.driftVelocity > 0. && cf.tMax > cf.tMin && cf.nChargeBins > 0 && cf.qMax > 0.)){
+    throw art::Exception(art::errors::Configuration)
+      << "ChargeFits: ChannelsPerCRP, DriftVelocity, NChargeBins and ChargeMax must be positive and TimeMax above TimeMin\n";
+  }
+  if(cf.enable && !(lg.rangeLow < lg.rangeHigh && lg.convolutionSteps > 0 && lg.maxIterations > 0)){
+    throw art::Exception(art::errors::Configuration)
+      << "ChargeFits: FitRangeLow must be below FitRangeHigh, ConvolutionSteps and MaxIterations positive\n";
+  }
+  ChargeFitAccumulator chargeFitCheck;
+  try{
+    chargeFitCheck.Configure(cf);
+  }
+  catch(std::runtime_error const & e){
+    throw art::Exception(art::errors::Configuration) << "ChargeFits: " << e.what() << "\n";
+  }
+
+  // Sparse voxel map of the points' dQ/dx, for detector-uniformity maps
+  fhicl::ParameterSet const voxelCharge = p.get<fhicl::ParameterSet>("VoxelCharge", fhicl::ParameterSet());
+  VoxelChargeConfig & vc = fVoxelConfig;
+  vc.enable      = voxelCharge.get<bool>("Enable", false);
+  vc.nPlanes     = fNPlanes;
+  vc.splitPlanes = voxelCharge.get<bool>("SplitPlanes", vc.splitPlanes);
+  std::vector<double> const voxelSize = voxelCharge.get< std::vector<double> >("VoxelSize", { vc.size[0], vc.size[1], vc.size[2] });
+  std::vector<double> const voxelOrigin = voxelCharge.get< std::vector<double> >("Origin", { vc.origin[0], vc.origin[1], vc.origin[2] });
+  if(voxelSize.size() != 3 || voxelOrigin.size() != 3){
+    throw art::Exception(art::errors::Configuration)
+      << "VoxelCharge.VoxelSize and VoxelCharge.Origin: expected [ x, y, z ], got "
+      << voxelSize.size() << " and " << voxelOrigin.size() << " values\n";
+  }
+  for(int axis = 0; axis < 3; axis++){
+    vc.size[axis] = voxelSize[axis];
+    vc.origin[axis] = voxelOrigin[axis];
+  }
+  try{
+    VoxelChargeAccumulator().Configure(vc);
+  }
+  catch(std::runtime_error const & e){
+    throw art::Exception(art::errors::Configuration) << "VoxelCharge: " << e.what() << "\n";
+  }
+
+  // Products plan: only read what the enabled output needs
+  fhicl::ParameterSet const plan = p.get<fhicl::ParameterSet>("ProductsPlan", fhicl::ParameterSet());
+  fRequireSpacePoints = plan.get<bool>("RequireSpacePoints", true);
+  fPlan.fill(false);
+  fPlan[kPFParticles]        = true;
+  fPlan[kPFPTrackAssns]      = true;
+  fPlan[kTrackHitAssns]      = true; // always: the start tick cut reads the hit of the first valid point
+  fPlan[kCalorimetryAssns]   = fCore.UsesCalorimetry() || lt.enable || sm.enable || cf.enable || vc.enable;
+  fPlan[kPFPSpacePointAssns] = fRequireSpacePoints;
+  fPlan[kTracks]             = !fSelectionFirst; // the full-collection mode indexes associations by track key
+  // The lifetime drift times from PeakTime, the gain lookup of the
+  // lifetime, stopping-muon, charge-fit and voxel charge and the CRP of
+  // the charge-fit points also read every hit
+  fAllHits = fCore.UsesHits() || (lt.enable && (lt.source == LifetimeConfig::kPeakTime || fGainTable))
+    || (sm.enable && fGainTable) || (cf.enable && (fGainTable || chargeFitCheck.UsesChannels()))
+    || (vc.enable && fGainTable);
 
+  // Declare everything the plan reads, from the configured labels
+  fPFParticleToken = consumes< std::vector<recob::PFParticle> >(fPFParticleLabel);
+  if(Reads(kTracks))      fTrackToken      = consumes< std::vector<recob::Track> >(fTrackModuleLabel);
+  consumes< art::Assns<recob::PFParticle, recob::Track> >(fTrackModuleLabel);
+  consumes< art::Assns<recob::Track, recob::Hit> >(fTrackModuleLabel);
+  if(Reads(kCalorimetryAssns))   consumes< art::Assns<recob::Track, anab::Calorimetry> >(fCalorimetryLabel);
+  if(Reads(kPFPSpacePointAssns)) consumes< art::Assns<recob::PFParticle, recob::SpacePoint> >(fSpacePointModuleLabel);
+
+  // Events are independent: let art run analyze() on several schedules at
+  // once. Their only shared output, fOutputFile, is written through
+  // WriteRecord; the TFileService objects are only filled in endJob.
+  async<art::InEvent>();
 }
 
 
 
-void test::MyPDDPTestAna::analyze(art::Event const & e)                                       
+void test::MyPDDPTestAna::analyze(art::Event const & e, art::ProcessingFrame const & frame)
 {  
   // Implementation of required member function here.
-  fEventID = e.id().event();
-
-  fNPFParticles = 0;
-  fNPrimaries   = 0;
-  fNTracks      = 0;
-  fTrackLength.clear();
-  fNHits.clear();
-  fX.clear(); fY.clear(); fZ.clear();
-  fStartX.clear(); fStartY.clear(); fStartZ.clear(); 
-  fEndX.clear(); fEndY.clear(); fEndZ.clear(); 
-  fStartTick.clear();
-  fView.clear();
-  fPeakTime.clear();//fPeakTime0.clear(); fPeakTime1.clear();
-  fHitIntegral.clear();//fHitIntegral0.clear(); fHitIntegral1.clear();
-  fdQdx.clear();
-  fdQdx0.clear(); fdQdx1.clear();
-  fPlanenum.clear(); 
+  ScheduleData & data = fScheduleData[frame.scheduleID()];
+  data.timer.StartEvent();
+  EventRecord & rec = data.record;
+  auto const CountRead = [&data](Product prod){ data.nReads[prod]++; };
+
+  data.arena.BeginEvent(rec);
+  fCore.BeginEvent(rec, e.id().event());
   
   art::Handle< std::vector<recob::PFParticle> > pfparticleListHandle;
   std::vector<art::Ptr<recob::PFParticle> > pfparticlelist;
   art::Handle< std::vector<recob::Track> > trackListHandle;
   std::vector<art::Ptr<recob::Track> > tracklist;
-  art::Handle< std::vector<recob::SpacePoint> > spacepointListHandle;              
-  std::vector<art::Ptr<recob::SpacePoint> > spacepointlist;
-  art::Handle< std::vector<recob::Hit> > hitListHandle;       
-  std::vector<art::Ptr<recob::Hit> > hitlist;
-  if(e.getByLabel("pandora", pfparticleListHandle)) {
+  if(e.getByToken(fPFParticleToken, pfparticleListHandle)) {
     art::fill_ptr_vector(pfparticlelist, pfparticleListHandle);
+    CountRead(kPFParticles);
   }
-  if(e.getByLabel("pandoraTrack", trackListHandle)) { //make sure the Handle is valid
+  if(Reads(kTracks) && e.getByToken(fTrackToken, trackListHandle)) { //make sure the Handle is valid
     art::fill_ptr_vector(tracklist, trackListHandle);
+    CountRead(kTracks);
   }
-  if(e.getByLabel("pandora", spacepointListHandle)) {
-    art::fill_ptr_vector(spacepointlist, spacepointListHandle);                      
-  }
-  if(e.getByLabel("dprawhit", hitListHandle)) {
-    art::fill_ptr_vector(hitlist, hitListHandle);                
+
+  data.timer.Lap(kPhaseProducts);
+
+  if(!pfparticlelist.size()){
+    data.arena.EndEvent(rec);
+    data.timer.EndEvent();
+    return;
   }
+  rec.nPFParticles = pfparticlelist.size();
+
+  // Optional associations, only built when the products plan asks for them
+  std::optional< art::FindManyP<recob::SpacePoint> > spacepointAssoc;
+  std::optional< art::FindMany<anab::Calorimetry> > calorimetryAssoc;
+  std::vector< anab::Calorimetry const * > const noCalorimetry;
+  auto const TrackCalo = [&](std::size_t i) -> std::vector< anab::Calorimetry const * > const & {
+    return calorimetryAssoc ? calorimetryAssoc->at(i) : noCalorimetry;
+  };
+
+  if(fSelectionFirst){
+    // Select the primary muons first, then only build the associations for them
+    data.pfpViews.clear();
+    for(const art::Ptr<recob::PFParticle> &pfp : pfparticlelist){
+      data.pfpViews.push_back(PFParticleView{ pfp->IsPrimary(), pfp->PdgCode() });
+    }
+    fCore.SelectPrimaryMuons(data.pfpViews, data.selected);
+    std::vector< art::Ptr<recob::PFParticle> > & muonlist = data.muonlist;
+    muonlist.clear();
+    for(std::size_t i : data.selected) muonlist.push_back(pfparticlelist[i]);
+    rec.nPrimaries = muonlist.size();
+    data.timer.Lap(kPhaseLoops);
 
-  if(!pfparticlelist.size()) return;
-  fNPFParticles = pfparticlelist.size();
+    art::FindManyP<recob::Track> trackAssoc(muonlist, e, fTrackModuleLabel);
+    CountRead(kPFPTrackAssns);
+    if(Reads(kPFPSpacePointAssns)){
+      spacepointAssoc.emplace(muonlist, e, fSpacePointModuleLabel);
+      CountRead(kPFPSpacePointAssns);
+    }
+    data.timer.Lap(kPhaseAssociations);
 
-  art::FindManyP<recob::Track> trackAssoc(pfparticlelist, e, fTrackModuleLabel); //accessing the recob::Track objects associated with everything in the pfparticlelist vector
-  art::FindManyP<recob::SpacePoint> spacepointAssoc(pfparticlelist, e, fSpacePointModuleLabel);
-  art::FindManyP<recob::Hit> hittrackAssoc(tracklist, e, fTrackModuleLabel);
-  art::FindManyP<recob::Hit> hitspAssoc(spacepointlist, e, fHitModuleLabel);
-  art::FindManyP<anab::Calorimetry> calorimetryAssoc(tracklist, e, fCalorimetryLabel);
-  art::FindManyP<recob::Hit, recob::TrackHitMeta> fmthm(tracklist, e, fTrackModuleLabel);  
+    std::vector< art::Ptr<recob::Track> > & selectedtracks = data.selectedtracks;
+    selectedtracks.clear();
+    for(size_t i = 0; i < muonlist.size(); i++){
+      std::vector< art::Ptr<recob::Track> > const & pfptrack = trackAssoc.at(i);
+      if(pfptrack.empty()) continue;
+      if(fRequireSpacePoints && spacepointAssoc->at(i).empty()) continue;
+      selectedtracks.insert(selectedtracks.end(), pfptrack.begin(), pfptrack.end());
+    }
+    data.timer.Lap(kPhaseLoops);
+
+    // Associations indexed by position in selectedtracks.
+    // Hits and calorimetry are only read here, so bare pointers are enough.
+    art::FindMany<recob::Hit> hittrackAssoc(selectedtracks, e, fTrackModuleLabel);
+    CountRead(kTrackHitAssns);
+    if(Reads(kCalorimetryAssns)){
+      calorimetryAssoc.emplace(selectedtracks, e, fCalorimetryLabel);
+      CountRead(kCalorimetryAssns);
+    }
+    data.timer.Lap(kPhaseAssociations);
+
+    // Reserve the record from the association sizes before filling it
+    RecordSizes expected;
+    expected.tracks = selectedtracks.size();
+    for(size_t i = 0; i < selectedtracks.size(); i++){
+      expected.hits += hittrackAssoc.at(i).size();
+      for(anab::Calorimetry const * cal : TrackCalo(i)){
+        expected.calos++;
+        expected.points += cal->dQdx().size();
+      }
+    }
+    data.arena.Reserve(rec, expected, fRecordMask);
+
+    data.trackInputs.clear();
+    for(size_t i = 0; i < selectedtracks.size(); i++){
+      data.trackInputs.push_back(TrackInput{ selectedtracks[i].get(), &hittrackAssoc.at(i), &TrackCalo(i) });
+    }
+    ProcessTracks(data);
+  }
+  else{
+    art::FindManyP<recob::Track> trackAssoc(pfparticlelist, e, fTrackModuleLabel); //accessing the recob::Track objects associated with everything in the pfparticlelist vector
+    CountRead(kPFPTrackAssns);
+    if(Reads(kPFPSpacePointAssns)){
+      spacepointAssoc.emplace(pfparticlelist, e, fSpacePointModuleLabel);
+      CountRead(kPFPSpacePointAssns);
+    }
+    art::FindMany<recob::Hit> hittrackAssoc(tracklist, e, fTrackModuleLabel);
+    CountRead(kTrackHitAssns);
+    if(Reads(kCalorimetryAssns)){
+      calorimetryAssoc.emplace(tracklist, e, fCalorimetryLabel);
+      CountRead(kCalorimetryAssns);
+    }
+    data.timer.Lap(kPhaseAssociations);
+
+    // The associations cover every track of the event: reserve from the
+    // high-water mark only
+    data.arena.Reserve(rec, RecordSizes(), fRecordMask);
   
-  for(const art::Ptr<recob::PFParticle> &pfp : pfparticlelist){
-    
-    
-    if( !(pfp->IsPrimary() && std::abs(pfp->PdgCode()) == 13) ) continue; 
-    fNPrimaries++;
-    std::vector< art::Ptr<recob::SpacePoint> > pfpspacepoint = spacepointAssoc.at(pfp.key());
-    std::vector< art::Ptr<recob::Track> > pfptrack = trackAssoc.at(pfp.key());
-    if(!pfptrack.empty() && !pfpspacepoint.empty()){
-      //fNTracks++;
-      // for(const art::Ptr<recob::SpacePoint> &sp : pfpspacepoint){
-	// fX.push_back(sp->XYZ()[0]); fY.push_back(sp->XYZ()[1]); fZ.push_back(sp->XYZ()[2]); */
-  //}
+    data.trackInputs.clear();
+    for(const art::Ptr<recob::PFParticle> &pfp : pfparticlelist){
+      if( !AnaCore::IsPrimaryMuon(PFParticleView{ pfp->IsPrimary(), pfp->PdgCode() }) ) continue; 
+      rec.nPrimaries++;
+      std::vector< art::Ptr<recob::Track> > const & pfptrack = trackAssoc.at(pfp.key());
+      if(fRequireSpacePoints && spacepointAssoc->at(pfp.key()).empty()) continue;
       for(const art::Ptr<recob::Track> &trk: pfptrack){
-	fNTracks++;
-	std::vector< art::Ptr<recob::Hit> > trackhit = hittrackAssoc.at(trk.key());
-	if(!(trackhit[trk->FirstValidPoint()]->PeakTime() > 100) ) continue;
-	//std::vector< recob::TrackHitMeta const* > & data
-	fTrackLength.push_back(trk->Length());
-        if(!trackhit.empty()){
-	  fNHits.push_back(trackhit.size());
-	  fStartTick.push_back(trackhit[trk->FirstValidPoint()]->PeakTime());
-          for(const art::Ptr<recob::Hit>  &hit : trackhit){
-	    int view = hit->WireID().Plane;
-	    fView.push_back(view);
-	    fPeakTime.push_back(hit->PeakTime());
-	    double dq = hit->Integral();
-	    fHitIntegral.push_back(dq);
-	    
-	  }  
-        } 
-	
-	fStartX.push_back(trk->Start().X()); fStartY.push_back(trk->Start().Y()); fStartZ.push_back(trk->Start().Z());
-        fEndX.push_back(trk->End().X()); fEndY.push_back(trk->End().Y()); fEndZ.push_back(trk->End().Z()); 
-
-	std::vector< art::Ptr<anab::Calorimetry> > trackcalo = calorimetryAssoc.at(trk.key());
-        if (!trackcalo.empty()){
-
-	  for (const art::Ptr <anab::Calorimetry> &cal : trackcalo){
-	    if(!cal->PlaneID().isValid) continue; 
-	    int planenum = cal->PlaneID().Plane;
-	    fPlanenum.push_back(planenum);  
-	    int calsize = cal->dQdx().size();
-	    for(int i = 0; i < calsize ; i++){
-	      fX.push_back(cal->XYZ()[i].X()); fY.push_back(cal->XYZ()[i].Y()); fZ.push_back(cal->XYZ()[i].Z());
-	    }
-	    if (planenum == 0){
-	      for(float dqdx : cal->dQdx()){
-		fdQdx0.push_back( dqdx / C );  // C = 89.1 [ADC/fC]
-		fdQdxhist->Fill( dqdx / C);
-	      }  
-	    }
-	    if (planenum == 1){
-	      for(float dqdx : cal->dQdx()){
-		fdQdx1.push_back( dqdx / C );  // C = 89.1 [ADC/fC]
-		fdQdxhist->Fill( dqdx / C);
-	      } 
-	    }
-	  }
-	  
-        }//end if(!trackcalo.empty())	
+        data.trackInputs.push_back(TrackInput{ trk.get(), &hittrackAssoc.at(trk.key()), &TrackCalo(trk.key()) });
       }//end for loop on pfptracks
-    }//end if(!pfptrack.empty())
-  }//end for loop on pfparticles
+    }//end for loop on pfparticles
+    ProcessTracks(data);
+  }
+  
+  data.timer.Lap(kPhaseLoops);
   
-  fOutputTree->Fill(); 
+  WriteRecord(rec);
+  data.arena.EndEvent(rec);
+  data.timer.Lap(kPhaseFill);
+  data.timer.EndEvent();
+}
+
+test::TrackView test::MyPDDPTestAna::MakeTrackView(TrackInput const & input,
+                                                   std::vector<HitView> & hitViews,
+                                                   std::vector<CaloView> & caloViews) const
+{
+  recob::Track const & trk = *input.track;
+  std::vector< recob::Hit const * > const & trackhit = *input.hits;
+  std::vector< anab::Calorimetry const * > const & trackcalo = *input.calos;
+
+  // geo::Point_t is three contiguous doubles, so XYZ() can be viewed as an interleaved array
+  static_assert(sizeof(geo::Point_t) == 3 * sizeof(double), "unexpected geo::Point_t layout");
+
+  // Without hit output, only the hits up to the first valid point are
+  // viewed: the core reads that one for the start tick cut
+  std::size_t const nViews = fAllHits ? trackhit.size() : std::min(trackhit.size(), std::size_t(trk.FirstValidPoint()) + 1);
+  hitViews.clear();
+  for(std::size_t i = 0; i < nViews; i++){
+    recob::Hit const * hit = trackhit[i];
+    hitViews.push_back(HitView{ hit->PeakTime(), hit->Integral(), int(hit->WireID().Plane), hit->Channel() });
+  }
+  caloViews.clear();
+  for(anab::Calorimetry const * cal : trackcalo){
+    std::size_t const n = cal->dQdx().size();
+    std::vector<std::size_t> const & tp = cal->TpIndices();
+    std::vector<float> const & resRange = cal->ResidualRange();
+    std::vector<float> const & pitch = cal->TrkPitchVec();
+    caloViews.push_back(CaloView{ bool(cal->PlaneID().isValid), int(cal->PlaneID().Plane), n,
+                                  cal->dQdx().data(), reinterpret_cast<double const *>(cal->XYZ().data()),
+                                  tp.size() == n ? tp.data() : nullptr,
+                                  resRange.size() == n ? resRange.data() : nullptr,
+                                  pitch.size() == n ? pitch.data() : nullptr });
+  }
 
+  TrackView view;
+  view.length = trk.Length();
+  view.start[0] = trk.Start().X(); view.start[1] = trk.Start().Y(); view.start[2] = trk.Start().Z();
+  view.end[0] = trk.End().X(); view.end[1] = trk.End().Y(); view.end[2] = trk.End().Z();
+  view.firstValidPoint = trk.FirstValidPoint();
+  view.nHits = trackhit.size();
+  view.hits = hitViews;
+  view.calos = caloViews;
+  return view;
 }
 
-void test::MyPDDPTestAna::beginJob()
+void test::MyPDDPTestAna::ProcessTracks(ScheduleData & data) const
+{
+  std::vector<TrackInput> const & inputs = data.trackInputs;
+  if(fParallelTrackThreshold == 0 || inputs.size() < fParallelTrackThreshold){
+    for(TrackInput const & input : inputs){
+      fCore.ProcessTrack(MakeTrackView(input, data.hitViews, data.caloViews), data.record, data.acc);
+    }
+    return;
+  }
+
+  // Each task fills its own partial, and the histograms and lifetime of
+  // its thread (merged at endJob)
+  if(data.partials.size() < inputs.size()) data.partials.resize(inputs.size());
+  tbb::parallel_for(std::size_t(0), inputs.size(), [this, &data, &inputs](std::size_t i){
+      TrackPartial & part = data.partials[i];
+      fCore.BeginEvent(part.record, 0);
+      fCore.ProcessTrack(MakeTrackView(inputs[i], part.hitViews, part.caloViews), part.record, fTrackAccumulators->local());
+    });
+  for(std::size_t i = 0; i < inputs.size(); i++) fCore.AppendPartial(data.partials[i].record, data.record);
+  data.nParallelEvents++;
+}
+
+void test::MyPDDPTestAna::WriteRecord(EventRecord const & record)
+{
+  // Asynchronous: the record is copied to a free writer buffer, which the
+  // writer thread swaps into fTreeRecord before filling (FillTree is only
+  // ever called from that thread then)
+  if(fWriter){
+    fWriter->Submit(record, fFillMask);
+    return;
+  }
+
+  // The branches point at fTreeRecord: copy the arena-backed record into
+  // it and fill under one lock. Assign reuses the buffers' capacity.
+  std::lock_guard<std::mutex> lock(fTreeMutex);
+  fTreeRecord.Assign(record, fFillMask);
+  FillTree();
+}
+
+void test::MyPDDPTestAna::FillTree()
+{
+  EncodeBranches(fOutputTree);
+  fSplitEntry = fOutputTree->GetEntries();
+  fOutputTree->Fill();
+  if(fSplitTrees) FillTrackTrees();
+}
+
+void test::MyPDDPTestAna::EncodeBranches(TTree * tree)
+{
+  for(ReducedBranch & br : fReducedBranches){
+    if(br.tree == tree) br.encoder->Encode(TreeBuffers(tree).*br.column);
+  }
+}
+
+test::MyPDDPTestAna::TreeSlot test::MyPDDPTestAna::EntryTree(RecordField f) const
+{
+  if(!fSplitTrees) return kMainTree;
+  if(f == kRecordTrackHitOffset || f == kRecordTrackPointOffset) return kNoTree;
+  if(kRecordFieldLengths[f] == RecordLength::hits) return kHitTree;
+  if(kRecordFieldLengths[f] == RecordLength::points) return kPointTree;
+  return kMainTree;
+}
+
+void test::MyPDDPTestAna::FillTrackTrees()
+{
+  TreeRecord const & rec = fTreeRecord;
+  TreeRecord & slice = fTrackSlice;
+  std::vector< unsigned int > const & hitOffset = rec.TrackHitOffset;
+  std::vector< unsigned int > const & pointOffset = rec.TrackPointOffset;
+  if(hitOffset.empty() && pointOffset.empty()) return;
+  std::size_t const nTracks = std::max(hitOffset.size(), pointOffset.size()) - 1; // both start with a 0
+
+  fPlaneCursor.assign(fNPlanes, 0);
+  fPlaneCount.resize(fNPlanes);
+  for(std::size_t i = 0; i < nTracks; i++){
+    fSplitTrack = i;
+    // Track i's range of every per-hit and per-point column
+    TreeRecord::ForEachColumn([&](RecordField f, auto & to, auto const & from){
+        if(!fRecordMask.Field(f)) return;
+        if(EntryTree(f) == kHitTree) to.assign(from.begin() + hitOffset[i], from.begin() + hitOffset[i + 1]);
+        else if(EntryTree(f) == kPointTree) to.assign(from.begin() + pointOffset[i], from.begin() + pointOffset[i + 1]);
+      }, slice, rec);
+    // The per-point plane columns hold the track's points of each plane in order
+    if(fPointTree){
+      for(int plane = 0; plane < fNPlanes; plane++){
+        fPlaneCount[plane] = std::count(rec.PointPlane.begin() + pointOffset[i], rec.PointPlane.begin() + pointOffset[i + 1], plane);
+      }
+      TreeRecord::ForEachPlaneColumn([&](RecordPlaneField f, std::size_t plane, auto & to, auto const & from){
+          if(PlaneEntryTree(f) != kPointTree || !fRecordMask.Plane(f, plane)) return;
+          auto const first = from.begin() + fPlaneCursor[plane];
+          to.assign(first, first + fPlaneCount[plane]);
+        }, slice, rec);
+      for(int plane = 0; plane < fNPlanes; plane++) fPlaneCursor[plane] += fPlaneCount[plane];
+    }
+    if(fHitTree){
+      EncodeBranches(fHitTree);
+      fHitTree->Fill();
+    }
+    if(fPointTree){
+      EncodeBranches(fPointTree);
+      fPointTree->Fill();
+    }
+  }
+}
+
+void test::MyPDDPTestAna::beginJob(art::ProcessingFrame const &)
 {
   // Implementation of optional member function here.
   art::ServiceHandle<art::TFileService> tfs;
-  fOutputTree = tfs->make<TTree >("mytree", "My Tree");
-  fOutputTree->Branch("eventID", &fEventID, "eventID/i");
-  fOutputTree->Branch("nPFParticles", &fNPFParticles, "nPFParticles/i");
-  fOutputTree->Branch("nPrimaries", &fNPrimaries, "nPrimaries/i");
-  fOutputTree->Branch("nTracks", &fNTracks, "nTracks/i");
-  fOutputTree->Branch("nPrimaryDaughters", &fNPrimaryDaughters, "nPrimaryDaughters/i");
-  fOutputTree->Branch("TrackLength", &fTrackLength);
-  fOutputTree->Branch("nHits", &fNHits);
-  fOutputTree->Branch("X", &fX);//, "X/D" ); 
-  fOutputTree->Branch("Y", &fY);//, "Y/D" );
-  fOutputTree->Branch("Z", &fZ);//, "Z/D" );
-  fOutputTree->Branch("StartX", &fStartX);
-  fOutputTree->Branch("StartY", &fStartY);
-  fOutputTree->Branch("StartZ", &fStartZ);
-  fOutputTree->Branch("EndX", &fEndX);
-  fOutputTree->Branch("EndY", &fEndY);
-  fOutputTree->Branch("EndZ", &fEndZ);
-  fOutputTree->Branch("StartTick", &fStartTick);
-  fOutputTree->Branch("View", &fView);
-  fOutputTree->Branch("PeakTime", &fPeakTime);
-  //fOutputTree->Branch("PeakTime0", &fPeakTime0);
-  //fOutputTree->Branch("PeakTime1", &fPeakTime1);
-  fOutputTree->Branch("HitIntegral", &fHitIntegral);
-  //fOutputTree->Branch("HitIntegral0", &fHitIntegral0);
-  //fOutputTree->Branch("HitIntegral1", &fHitIntegral1);
-  fOutputTree->Branch("dQdx0", &fdQdx0);
-  fOutputTree->Branch("dQdx1", &fdQdx1);
-  fOutputTree->Branch("Planenum", &fPlanenum); //, "");
+  TreeRecord & rec = fTreeRecord;
+  rec.SetNPlanes(fNPlanes);
+
+  // The trees are made in fOutputFile, which owns them; gDirectory is
+  // restored on leaving the scope
+  std::string const fileName = fOutputTreeConfig.get<std::string>("FileName", "mytree.root");
+  TDirectory::TContext const context;
+  fOutputFile.reset(TFile::Open(fileName.c_str(), "RECREATE"));
+  if(!fOutputFile || fOutputFile->IsZombie()){
+    throw art::Exception(art::errors::FileOpenError) << "OutputTree.FileName: cannot create '" << fileName << "'\n";
+  }
+  fOutputTree = new TTree("mytree", "My Tree");
+
+  // Split trees, only made when they get a column; their entries are keyed
+  // by the mytree entry and the index of the track in its track columns
+  if(fSplitTrees){
+    fTrackSlice.SetNPlanes(fNPlanes);
+    if(fFillMask.Field(kRecordTrackHitOffset)) fHitTree = new TTree("hits", "Hits of each track");
+    if(fFillMask.Field(kRecordTrackPointOffset)) fPointTree = new TTree("points", "Calorimetry points of each track");
+    for(TTree *tree : { fHitTree, fPointTree }){
+      if(!tree) continue;
+      tree->Branch("Entry", &fSplitEntry, "Entry/L");
+      tree->Branch("Track", &fSplitTrack, "Track/i");
+    }
+  }
+
+  // Every enabled schema entry (EventRecord.h), with the leaf type of its C++ type
+#define MYPDDPTESTANA_SCALAR(type, name) \
+  if(fRecordMask.Field(kRecord##name)) fOutputTree->Branch(#name, &rec.name, LeafList<type>(#name).c_str());
+  MYPDDPTESTANA_RECORD_SCALARS(MYPDDPTESTANA_SCALAR)
+#undef MYPDDPTESTANA_SCALAR
+#define MYPDDPTESTANA_COLUMN(type, name, size, group) \
+  if(fRecordMask.Field(kRecord##name) && SlotTree(EntryTree(kRecord##name))) \
+    BranchColumn(SlotTree(EntryTree(kRecord##name)), #name, &TreeRecord::name);
+  MYPDDPTESTANA_RECORD_COLUMNS(MYPDDPTESTANA_COLUMN)
+#undef MYPDDPTESTANA_COLUMN
+  // and of each plane column, one branch per plane
+#define MYPDDPTESTANA_PLANE_COLUMN(type, name, size, group) \
+  for(int plane = 0; plane < fNPlanes; plane++){ \
+    TTree *planeTree = SlotTree(PlaneEntryTree(kRecordPlane##name)); \
+    if(!fRecordMask.Plane(kRecordPlane##name, plane) || !planeTree) continue; \
+    planeTree->Branch((#name + std::to_string(plane)).c_str(), &TreeBuffers(planeTree).Plane##name[plane]); \
+  }
+  MYPDDPTESTANA_RECORD_PLANE_COLUMNS(MYPDDPTESTANA_PLANE_COLUMN)
+#undef MYPDDPTESTANA_PLANE_COLUMN
   
-  fdQdxhist = tfs->make<TH1D>("hdQdx", ";dQdx [fC/cm]", 50, 0, 50);
+  ConfigureOutputTree();
+
+  fdQdxhist = nullptr;
+  fPlanedQdxhist.clear();
+  if(fHistograms) fdQdxhist = tfs->make<TH1D>("hdQdx", ";dQdx [fC/cm]", fHistBins, fHistMin, fHistMax);
+  for(int plane = 0; fHistograms && plane < fNPlanes; plane++){
+    std::string const name = "hdQdx" + std::to_string(plane);
+    std::string const title = "Plane " + std::to_string(plane) + ";dQdx [fC/cm]";
+    fPlanedQdxhist.push_back(tfs->make<TH1D>(name.c_str(), title.c_str(), fHistBins, fHistMin, fHistMax));
+  }
+  for(ScheduleData & data : fScheduleData){
+    data.arena = RecordArena(fRecordArenaBytes);
+    data.record.SetNPlanes(fNPlanes);
+    fCore.ConfigureAccumulators(data.acc, fHistBins, fHistMin, fHistMax);
+    data.acc.lifetime.Configure(fLifetimeConfig);
+    data.acc.stopping.Configure(fStoppingConfig);
+    data.acc.chargeFits.Configure(fChargeFitConfig);
+    data.acc.voxels.Configure(fVoxelConfig);
+    data.timer.Resize(kNPhases);
+    data.timer.SetEnabled(fPhaseTiming);
+  }
+
+  AnaAccumulators exemplar;
+  fCore.ConfigureAccumulators(exemplar, fHistBins, fHistMin, fHistMax);
+  exemplar.lifetime.Configure(fLifetimeConfig);
+  exemplar.stopping.Configure(fStoppingConfig);
+  exemplar.chargeFits.Configure(fChargeFitConfig);
+  exemplar.voxels.Configure(fVoxelConfig);
+  fTrackAccumulators = std::make_unique< tbb::enumerable_thread_specific<AnaAccumulators> >(exemplar);
+
+  if(fWriterDepth > 0){
+    fWriter = std::make_unique<AsyncRecordWriter>(fWriterDepth, [this](TreeRecord & record){
+        fTreeRecord.Swap(record);
+        FillTree();
+      });
+  }
+}
+
+void test::MyPDDPTestAna::BranchDouble(TTree * tree, const char * name, std::vector< double > TreeRecord::* column)
+{
+  fhicl::ParameterSet const precision = fOutputTreeConfig.get<fhicl::ParameterSet>("Precision", fhicl::ParameterSet());
+  PrecisionSpec spec;
+  if(precision.has_key(name)){
+    fhicl::ParameterSet const cfg = precision.get<fhicl::ParameterSet>(name);
+    std::string const mode = cfg.get<std::string>("Type");
+    if(!PrecisionSpec::ParseMode(mode, spec.mode)){
+      throw art::Exception(art::errors::Configuration)
+        << "OutputTree.Precision." << name << ": unknown Type '" << mode
+        << "' (expected Double, Float, Float16 or Fixed)\n";
+    }
+    spec.bits = cfg.get<int>("Bits", 0);
+    spec.min  = cfg.get<double>("Min", 0.);
+    spec.max  = cfg.get<double>("Max", 0.);
+    std::string const problem = spec.Validate();
+    if(!problem.empty()){
+      throw art::Exception(art::errors::Configuration)
+        << "OutputTree.Precision." << name << ": " << problem << "\n";
+    }
+  }
+
+  if(spec.mode == PrecisionSpec::kDouble){
+    tree->Branch(name, &(TreeBuffers(tree).*column));
+    return;
+  }
+
+  ReducedBranch br{ name, tree, column, std::make_unique<ReducedPrecisionColumn>(spec) };
+  ReducedPrecisionColumn & enc = *br.encoder;
+  TBranch *branch = nullptr;
+  if(spec.mode != PrecisionSpec::kFixed) branch = tree->Branch(name, &enc.FloatBuffer());
+  else if(enc.UsesShort())              branch = tree->Branch(name, &enc.ShortBuffer());
+  else                                   branch = tree->Branch(name, &enc.IntBuffer());
+  // Fixed-point readers decode x = Min + q * (Max - Min) / (2^Bits - 1)
+  branch->SetTitle((std::string(name) + " " + spec.Describe()).c_str());
+  fReducedBranches.push_back(std::move(br));
 }
 
-void test::MyPDDPTestAna::endJob()
+void test::MyPDDPTestAna::ConfigureOutputTree()
 {
+  fhicl::ParameterSet const & cfg = fOutputTreeConfig;
+
+  // Compression: an empty algorithm keeps the output file's setting
+  using Algo = ROOT::RCompressionSetting::EAlgorithm;
+  std::string const algName = cfg.get<std::string>("CompressionAlgorithm", "");
+  int compression = -1;
+  if(!algName.empty()){
+    Algo::EValues alg;
+    if(algName == "ZLIB")      alg = Algo::kZLIB;
+    else if(algName == "LZMA") alg = Algo::kLZMA;
+    else if(algName == "LZ4")  alg = Algo::kLZ4;
+    else if(algName == "ZSTD") alg = Algo::kZSTD;
+    else{
+      throw art::Exception(art::errors::Configuration)
+        << "OutputTree.CompressionAlgorithm: unknown algorithm '" << algName
+        << "' (expected ZLIB, LZMA, LZ4 or ZSTD)\n";
+    }
+    compression = ROOT::CompressionSettings(alg, cfg.get<int>("CompressionLevel", 4));
+  }
+
+  // Basket sizes: a default for every branch, overridden per branch name
+  int const defaultBasket = cfg.get<int>("BasketSize", 0);
+  fhicl::ParameterSet const basketSizes = cfg.get<fhicl::ParameterSet>("BasketSizes", fhicl::ParameterSet());
+
+  // The same settings for mytree and the split trees
+  std::vector<TTree *> trees{ fOutputTree };
+  if(fHitTree) trees.push_back(fHitTree);
+  if(fPointTree) trees.push_back(fPointTree);
+
+  for(TTree *tree : trees){
+    TObjArray *branches = tree->GetListOfBranches();
+    for(int i = 0; i < branches->GetEntriesFast(); i++){
+      TBranch *br = static_cast<TBranch*>(branches->At(i));
+      if(compression >= 0) br->SetCompressionSettings(compression);
+      int const basket = basketSizes.get<int>(br->GetName(), defaultBasket);
+      if(basket > 0) br->SetBasketSize(basket);
+    }
+  }
+  for(std::string const & name : basketSizes.get_names()){
+    bool const known = std::any_of(trees.begin(), trees.end(), [&name](TTree *tree){ return tree->GetBranch(name.c_str()); });
+    if(!known){
+      mf::LogWarning("MyPDDPTestAna") << "OutputTree.BasketSizes: no branch named '" << name << "'";
+    }
+  }
+
+  // ROOT conventions: > 0 is a number of entries, < 0 a number of bytes, 0 keeps the default
+  long long const autoFlush = cfg.get<long long>("AutoFlush", 0);
+  long long const autoSave  = cfg.get<long long>("AutoSave", 0);
+  for(TTree *tree : trees){
+    if(autoFlush != 0) tree->SetAutoFlush(autoFlush);
+    if(autoSave != 0)  tree->SetAutoSave(autoSave);
+  }
 }
 
+void test::MyPDDPTestAna::WriteLifetime(LifetimeAccumulator const & lifetime)
+{
+  LifetimeConfig const & cfg = lifetime.Config();
+  std::vector<LifetimeBin> const bins = lifetime.Bins();
+  LifetimeFit const fit = lifetime.Fit(bins);
 
-DEFINE_ART_MODULE(test::MyPDDPTestAna)
+  art::ServiceHandle<art::TFileService> tfs;
+  TH1D *hMedian = tfs->make<TH1D>("hLifetimeMedian", ";drift time [#mus];median dQdx [fC/cm]", cfg.nTimeBins, cfg.tMin, cfg.tMax);
+  TH1D *hTrunc = tfs->make<TH1D>("hLifetimeTruncMean", ";drift time [#mus];truncated mean dQdx [fC/cm]", cfg.nTimeBins, cfg.tMin, cfg.tMax);
+  TH1D *hEntries = tfs->make<TH1D>("hLifetimeEntries", ";drift time [#mus];points", cfg.nTimeBins, cfg.tMin, cfg.tMax);
+  for(size_t i = 0; i < bins.size(); i++){
+    hMedian->SetBinContent(i + 1, bins[i].median);
+    hMedian->SetBinError(i + 1, bins[i].medianError);
+    hTrunc->SetBinContent(i + 1, bins[i].truncatedMean);
+    hEntries->SetBinContent(i + 1, bins[i].n);
+  }
+
+  LifetimeFit result = fit;
+  TTree *tree = tfs->make<TTree>("lifetime", "Electron lifetime fit of the median dQdx");
+  tree->Branch("Valid", &result.valid, "Valid/O");
+  tree->Branch("Tau", &result.tau, "Tau/D");
+  tree->Branch("TauError", &result.tauError, "TauError/D");
+  tree->Branch("Q0", &result.q0, "Q0/D");
+  tree->Branch("Q0Error", &result.q0Error, "Q0Error/D");
+  tree->Branch("Chi2", &result.chi2, "Chi2/D");
+  tree->Branch("Ndf", &result.ndf, "Ndf/I");
+  tree->Fill();
+
+  if(fit.valid){
+    mf::LogInfo("MyPDDPTestAna") << "Electron lifetime: " << fit.tau << " +- " << fit.tauError
+                                 << " us, chi2/ndf = " << fit.chi2 << "/" << fit.ndf;
+  }
+  else{
+    mf::LogWarning("MyPDDPTestAna") << "Electron lifetime fit failed (too few populated drift bins or no attenuation)";
+  }
+}
+
+void test::MyPDDPTestAna::WriteStoppingMuons(StoppingMuonAccumulator const & stopping)
+{
+  StoppingMuonConfig const & cfg = stopping.Config();
+  std::vector<StoppingMuonBin> const bins = stopping.FitBragg();
+
+  art::ServiceHandle<art::TFileService> tfs;
+  std::vector<TH2D *> hCharge;
+  std::vector<TH1D *> hMPV;
+  double const braggMax = std::min(cfg.braggRangeMax, cfg.rangeMax);
+  int const nBraggBins = std::min(cfg.nRangeBins, int(std::ceil(braggMax * cfg.nRangeBins / cfg.rangeMax)));
+  for(int plane = 0; plane < cfg.nPlanes; plane++){
+    std::string const suffix = std::to_string(plane);
+    std::string const title = "Plane " + suffix + " stopping muons;residual range [cm];dQdx [fC/cm]";
+    // Last charge bin: overflow, as in the accumulator
+    hCharge.push_back(tfs->make<TH2D>(("hStopMuondQdx" + suffix).c_str(), title.c_str(), cfg.nRangeBins, 0., cfg.rangeMax,
+                                      cfg.nChargeBins + 1, 0., cfg.qMax * (cfg.nChargeBins + 1) / cfg.nChargeBins));
+    hMPV.push_back(tfs->make<TH1D>(("hStopMuonMPV" + suffix).c_str(), title.c_str(), nBraggBins, 0., nBraggBins * cfg.rangeMax / cfg.nRangeBins));
+  }
+  std::vector<double> entries(cfg.nPlanes, 0.);
+  stopping.ForEachBin([&hCharge, &entries](int plane, int ir, int iq, unsigned long count){
+      hCharge[plane]->SetBinContent(ir + 1, iq + 1, count);
+      entries[plane] += count;
+    });
+  for(int plane = 0; plane < cfg.nPlanes; plane++){
+    hCharge[plane]->ResetStats();
+    hCharge[plane]->SetEntries(entries[plane]);
+  }
+
+  StoppingMuonBin bin;
+  TTree *tree = tfs->make<TTree>("stoppingmuon", "Most probable dQdx of the stopping muons per residual range bin");
+  tree->Branch("Plane", &bin.plane, "Plane/I");
+  tree->Branch("ResRange", &bin.resRange, "ResRange/D");
+  tree->Branch("Entries", &bin.n, "Entries/l");
+  tree->Branch("Valid", &bin.valid, "Valid/O");
+  tree->Branch("MPV", &bin.mpv, "MPV/D");
+  tree->Branch("MPVError", &bin.mpvError, "MPVError/D");
+  tree->Branch("Width", &bin.width, "Width/D");
+  int fitted = 0;
+  for(StoppingMuonBin const & b : bins){
+    bin = b;
+    tree->Fill();
+    if(!b.valid) continue;
+    fitted++;
+    int const ibin = hMPV[b.plane]->FindBin(b.resRange);
+    hMPV[b.plane]->SetBinContent(ibin, b.mpv);
+    hMPV[b.plane]->SetBinError(ibin, b.mpvError);
+  }
 
+  mf::LogInfo("MyPDDPTestAna") << "Stopping muons: " << stopping.StoppingTracks() << " tracks, "
+                               << stopping.PopulatedBins() << " populated (plane, residual range, dQdx) bins, "
+                               << fitted << " of " << bins.size() << " Bragg-region MPVs fitted";
+}
+
+void test::MyPDDPTestAna::WriteChargeFits(ChargeFitAccumulator const & fits)
+{
+  ChargeFitConfig const & cfg = fits.Config();
+  std::vector<ChargeFitAccumulator::Set> const & sets = fits.Sets();
+
+  // The fits are independent and LangausFit keeps no global state: one
+  // TBB task per histogram. ROOT objects are only touched below, serially.
+  std::vector< std::pair<std::size_t, int> > jobs; // (set, histogram)
+  for(std::size_t s = 0; s < sets.size(); s++){
+    for(int h = 0; h < sets[s].nHistograms; h++) jobs.emplace_back(s, h);
+  }
+  std::vector<LangausFitResult> results(jobs.size());
+  auto const start = std::chrono::steady_clock::now();
+  tbb::parallel_for(std::size_t(0), jobs.size(), [&](std::size_t j){
+      results[j] = fits.Fit(sets[jobs[j].first], jobs[j].second, fLangausConfig);
+    });
+  double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  art::ServiceHandle<art::TFileService> tfs;
+  std::string set;
+  int histogram, coordinates[ChargeFitAccumulator::kNDimensions];
+  double driftTime;
+  LangausFitResult result;
+  TTree *tree = tfs->make<TTree>("chargefits", "Landau-Gaussian fits of the dQdx histograms");
+  tree->Branch("Set", &set);
+  tree->Branch("Histogram", &histogram, "Histogram/I");
+  tree->Branch("Plane", &coordinates[ChargeFitAccumulator::kPlane], "Plane/I"); // -1: not split by the set
+  tree->Branch("CRP", &coordinates[ChargeFitAccumulator::kCRP], "CRP/I");
+  tree->Branch("DriftSlice", &coordinates[ChargeFitAccumulator::kDrift], "DriftSlice/I");
+  tree->Branch("DriftTime", &driftTime, "DriftTime/D"); // slice centre [us], -1 if not split
+  tree->Branch("Entries", &result.entries, "Entries/l"); // in the fit range
+  tree->Branch("Valid", &result.valid, "Valid/O");
+  tree->Branch("MPV", &result.mpv, "MPV/D");
+  tree->Branch("MPVError", &result.mpvError, "MPVError/D");
+  tree->Branch("Width", &result.width, "Width/D");
+  tree->Branch("WidthError", &result.widthError, "WidthError/D");
+  tree->Branch("Sigma", &result.sigma, "Sigma/D");
+  tree->Branch("SigmaError", &result.sigmaError, "SigmaError/D");
+  tree->Branch("Chi2", &result.chi2, "Chi2/D");
+  tree->Branch("Ndf", &result.ndf, "Ndf/I");
+
+  int fitted = 0;
+  for(std::size_t j = 0; j < jobs.size(); j++){
+    ChargeFitAccumulator::Set const & s = sets[jobs[j].first];
+    set = s.name;
+    histogram = jobs[j].second;
+    fits.Coordinates(s, histogram, coordinates);
+    int const slice = coordinates[ChargeFitAccumulator::kDrift];
+    driftTime = slice >= 0 ? fits.DriftSliceCentre(slice) : -1.;
+    result = results[j];
+    tree->Fill();
+    fitted += result.valid;
+
+    if(!fChargeFitHistograms) continue;
+    // The accumulator's overflow bin fills ROOT's
+    std::string const name = "hChargeFit_" + std::to_string(jobs[j].first) + "_" + std::to_string(histogram);
+    std::string const title = s.name + " histogram " + std::to_string(histogram) + ";dQdx [fC/cm]";
+    TH1D *hist = tfs->make<TH1D>(name.c_str(), title.c_str(), cfg.nChargeBins, 0., cfg.qMax);
+    unsigned long const * counts = &s.counts[std::size_t(histogram) * (cfg.nChargeBins + 1)];
+    double entries = 0.;
+    for(int iq = 0; iq <= cfg.nChargeBins; iq++){
+      hist->SetBinContent(iq + 1, counts[iq]);
+      entries += counts[iq];
+    }
+    hist->ResetStats();
+    hist->SetEntries(entries);
+  }
+
+  mf::LogInfo("MyPDDPTestAna") << "Charge fits: " << fitted << " of " << jobs.size() << " histograms in "
+                               << sets.size() << " sets fitted in " << seconds << " s";
+}
+
+void test::MyPDDPTestAna::WriteVoxelCharge(VoxelChargeAccumulator const & voxels)
+{
+  VoxelChargeConfig const & cfg = voxels.Config();
+  art::ServiceHandle<art::TFileService> tfs;
+  int plane, index[3];
+  double centre[3], sum, sum2, mean, rms;
+  unsigned long count;
+  TTree *tree = tfs->make<TTree>("voxelcharge", "dQdx of the calorimetry points per voxel");
+  tree->Branch("Plane", &plane, "Plane/I"); // -1: planes not split
+  tree->Branch("IX", &index[0], "IX/I");
+  tree->Branch("IY", &index[1], "IY/I");
+  tree->Branch("IZ", &index[2], "IZ/I");
+  tree->Branch("X", &centre[0], "X/D"); // voxel centre [cm]
+  tree->Branch("Y", &centre[1], "Y/D");
+  tree->Branch("Z", &centre[2], "Z/D");
+  tree->Branch("Count", &count, "Count/l");
+  tree->Branch("Sum", &sum, "Sum/D");   // [fC/cm]
+  tree->Branch("Sum2", &sum2, "Sum2/D"); // [(fC/cm)^2]
+  tree->Branch("Mean", &mean, "Mean/D");
+  tree->Branch("RMS", &rms, "RMS/D");
+
+  unsigned long points = 0;
+  voxels.ForEachVoxel([&](int p, int const * i, VoxelCharge const & voxel){
+      plane = p;
+      for(int axis = 0; axis < 3; axis++){
+        index[axis] = i[axis];
+        centre[axis] = cfg.origin[axis] + (i[axis] + 0.5) * cfg.size[axis];
+      }
+      count = voxel.count;
+      sum = voxel.Sum();
+      sum2 = voxel.Sum2();
+      mean = sum / count;
+      rms = std::sqrt(std::max(0., sum2 / count - mean * mean));
+      tree->Fill();
+      points += count;
+    });
+
+  mf::LogInfo("MyPDDPTestAna") << "Voxel charge map: " << points << " points in " << voxels.PopulatedVoxels()
+                               << " populated voxels of " << cfg.size[0] << " x " << cfg.size[1] << " x " << cfg.size[2]
+                               << " cm, " << voxels.SkippedPoints() << " points skipped";
+}
+
+void test::MyPDDPTestAna::ReportPhaseTiming(PhaseTimer const & timer)
+{
+  mf::LogInfo log("MyPDDPTestAna");
+  log << "Per-event phase latency [ms] (p50 / p95 / p99 / max, total [s]):";
+  auto const print = [&log](const char * name, LatencyHistogram const & h){
+    log << "\n  " << name << ": " << 1e3 * h.Quantile(0.50) << " / " << 1e3 * h.Quantile(0.95)
+        << " / " << 1e3 * h.Quantile(0.99) << " / " << 1e3 * h.Max() << ", " << h.Sum()
+        << " over " << h.Count() << " events";
+  };
+  for(int phase = 0; phase < kNPhases; phase++) print(kPhaseNames[phase], timer.Phase(phase));
+  print("Event", timer.Total());
+
+  if(!fPhaseTimingTree) return;
+
+  // One entry per phase, latencies in seconds, with the log-binned histogram
+  art::ServiceHandle<art::TFileService> tfs;
+  TTree *tree = tfs->make<TTree>("phasetiming", "Per-event phase latency");
+  std::string name;
+  unsigned long count;
+  double sum, mean, p50, p95, p99, max;
+  std::vector< unsigned long > counts;
+  std::vector< double > lowEdges;
+  for(int bin = 1; bin < LatencyHistogram::kNBins; bin++) lowEdges.push_back(LatencyHistogram::BinLowEdge(bin));
+  tree->Branch("Phase", &name);
+  tree->Branch("Count", &count, "Count/l");
+  tree->Branch("Sum", &sum, "Sum/D");
+  tree->Branch("Mean", &mean, "Mean/D");
+  tree->Branch("P50", &p50, "P50/D");
+  tree->Branch("P95", &p95, "P95/D");
+  tree->Branch("P99", &p99, "P99/D");
+  tree->Branch("Max", &max, "Max/D");
+  tree->Branch("BinCounts", &counts); // underflow, log bins, overflow
+  tree->Branch("BinLowEdges", &lowEdges); // low edges of BinCounts[1..]
+  for(int phase = 0; phase <= kNPhases; phase++){
+    LatencyHistogram const & h = phase < kNPhases ? timer.Phase(phase) : timer.Total();
+    name = phase < kNPhases ? kPhaseNames[phase] : "Event";
+    count = h.Count(); sum = h.Sum(); mean = h.Mean(); max = h.Max();
+    p50 = h.Quantile(0.50); p95 = h.Quantile(0.95); p99 = h.Quantile(0.99);
+    counts = h.Counts();
+    tree->Fill();
+  }
+}
+
+void test::MyPDDPTestAna::MergeHist(TH1D * hist, std::vector<HistPartial const *> const & partials)
+{
+  // Integer sums: the same histogram whatever the schedule/thread split
+  HistPartial merged;
+  merged.Reset(hist->GetNbinsX(), hist->GetXaxis()->GetXmin(), hist->GetXaxis()->GetXmax());
+  for(HistPartial const * partial : partials) merged.Merge(*partial);
+
+  for(size_t bin = 0; bin < merged.counts.size(); bin++) hist->SetBinContent(bin, merged.counts[bin]);
+  hist->ResetStats(); // recompute mean/RMS from the merged bins
+  hist->SetEntries(merged.Entries());
+}
+
+void test::MyPDDPTestAna::endJob(art::ProcessingFrame const &)
+{
+  // Everything below reads what the writer thread may still be filling
+  if(fWriter) fWriter->Close();
+
+  // (Entry, Track) lookup of the split trees, e.g. hits->GetEntryWithIndex(entry, track)
+  if(fHitTree) fHitTree->BuildIndex("Entry", "Track");
+  if(fPointTree) fPointTree->BuildIndex("Entry", "Track");
+
+  // The trees go away with their file
+  {
+    TDirectory::TContext const context(fOutputFile.get());
+    fOutputFile->Write();
+    fOutputFile->Close();
+  }
+  fOutputFile.reset();
+  fOutputTree = fHitTree = fPointTree = nullptr;
+
+  // Merge the per-schedule partials, and the per-thread ones of the parallel track tasks
+  std::array<unsigned long, kNProducts> nReads{};
+  PhaseTimer timer(kNPhases);
+  unsigned long parallelEvents = 0;
+  std::vector<AnaAccumulators const *> accumulators;
+  for(ScheduleData const & data : fScheduleData){
+    for(int prod = 0; prod < kNProducts; prod++) nReads[prod] += data.nReads[prod];
+    timer.Merge(data.timer);
+    parallelEvents += data.nParallelEvents;
+    accumulators.push_back(&data.acc);
+  }
+  for(AnaAccumulators const & acc : *fTrackAccumulators) accumulators.push_back(&acc);
+
+  LifetimeAccumulator lifetime;
+  lifetime.Configure(fLifetimeConfig);
+  for(AnaAccumulators const * acc : accumulators) lifetime.Merge(acc->lifetime);
+  StoppingMuonAccumulator stopping;
+  stopping.Configure(fStoppingConfig);
+  for(AnaAccumulators const * acc : accumulators) stopping.Merge(acc->stopping);
+  ChargeFitAccumulator chargeFits;
+  chargeFits.Configure(fChargeFitConfig);
+  for(AnaAccumulators const * acc : accumulators) chargeFits.Merge(acc->chargeFits);
+  VoxelChargeAccumulator voxels;
+  voxels.Configure(fVoxelConfig);
+  for(AnaAccumulators const * acc : accumulators) voxels.Merge(acc->voxels);
+
+  std::vector<HistPartial const *> partials;
+  for(AnaAccumulators const * acc : accumulators) partials.push_back(&acc->dQdx);
+  if(fHistograms) MergeHist(fdQdxhist, partials);
+  for(int plane = 0; fHistograms && plane < fNPlanes; plane++){
+    partials.clear();
+    for(AnaAccumulators const * acc : accumulators) partials.push_back(&acc->planedQdx[plane]);
+    MergeHist(fPlanedQdxhist[plane], partials);
+  }
+
+  if(lifetime.Enabled()) WriteLifetime(lifetime);
+  if(stopping.Enabled()) WriteStoppingMuons(stopping);
+  if(chargeFits.Enabled()) WriteChargeFits(chargeFits);
+  if(voxels.Enabled()) WriteVoxelCharge(voxels);
+
+  if(timer.Total().Count()){
+    LatencyHistogram const & total = timer.Total();
+    mf::LogInfo("MyPDDPTestAna") << (fSelectionFirst ? "Selection-first" : "Full-collection")
+                                 << " association mode: " << total.Count() << " events, "
+                                 << 1e3 * total.Mean() << " ms/event (max "
+                                 << 1e3 * total.Max() << " ms)";
+  }
+  if(fPhaseTiming) ReportPhaseTiming(timer);
+  if(fParallelTrackThreshold > 0){
+    mf::LogInfo("MyPDDPTestAna") << "Parallel track processing: " << parallelEvents << " of "
+                                 << timer.Total().Count() << " events with at least "
+                                 << fParallelTrackThreshold << " selected tracks";
+  }
+
+  if(!fReducedBranches.empty()){
+    mf::LogInfo log("MyPDDPTestAna");
+    log << "Reduced-precision branches (max |error| on in-range values):";
+    for(ReducedBranch const & br : fReducedBranches){
+      ReducedPrecisionColumn const & enc = *br.encoder;
+      log << "\n  " << br.name << " " << enc.Spec().Describe() << ": " << enc.MaxError()
+          << " over " << enc.NEncoded() << " values";
+      if(enc.NClipped()) log << ", " << enc.NClipped() << " clipped to the range";
+    }
+  }
+
+  mf::LogInfo log("MyPDDPTestAna");
+  log << "Products read (events):";
+  for(int prod = 0; prod < kNProducts; prod++){
+    log << "\n  " << kProductNames[prod] << ": ";
+    if(Reads(Product(prod))) log << nReads[prod];
+    else log << "disabled";
+  }
+
+  // Heap allocations of the event records; zero in steady state once the
+  // arenas have grown to the high-water mark
+  unsigned long arenaEvents = 0, arenaEventsWithAllocations = 0, arenaAllocations = 0;
+  std::size_t arenaBytes = 0;
+  for(ScheduleData const & data : fScheduleData){
+    arenaEvents += data.arena.Events();
+    arenaEventsWithAllocations += data.arena.EventsWithAllocations();
+    arenaAllocations += data.arena.TotalAllocations();
+    arenaBytes = std::max(arenaBytes, data.arena.BufferBytes());
+  }
+  mf::LogInfo("MyPDDPTestAna") << "Record arenas: " << arenaAllocations << " heap allocations in "
+                               << arenaEventsWithAllocations << " of " << arenaEvents << " events, "
+                               << "largest arena " << arenaBytes << " bytes";
+
+  if(fWriter){
+    // Occupancy: records already in flight when an event was handed over;
+    // stalls: events that found all Depth() buffers in flight
+    std::vector<unsigned long> const occupancy = fWriter->Occupancy();
+    unsigned long submitted = 0;
+    double occupied = 0.;
+    for(std::size_t k = 0; k < occupancy.size(); k++){
+      submitted += occupancy[k];
+      occupied += double(k) * occupancy[k];
+    }
+    LatencyHistogram const & stalls = fWriter->Stalls();
+    mf::LogInfo log("MyPDDPTestAna");
+    log << "Async writer: " << fWriter->Submitted() << " records, depth " << fWriter->Depth()
+        << ", mean occupancy " << (submitted ? occupied / submitted : 0.) << ", writer busy "
+        << fWriter->WriteSeconds() << " s\n  occupancy (records in flight: events):";
+    for(std::size_t k = 0; k < occupancy.size(); k++) log << " " << k << ": " << occupancy[k];
+    log << "\n  stalls: " << stalls.Count() << " events, " << stalls.Sum() << " s";
+    if(stalls.Count()){
+      log << " (p50 / p99 / max [ms]: " << 1e3 * stalls.Quantile(0.50) << " / "
+          << 1e3 * stalls.Quantile(0.99) << " / " << 1e3 * stalls.Max() << ")";
+    }
+  }
+}
+
+
+DEFINE_ART_MODULE(test::MyPDDPTestAna)
 
 
 
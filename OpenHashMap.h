@@ -0,0 +1,121 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       OpenHashMap
+// File:        OpenHashMap.h
+//
+// Open-addressing hash map from an unsigned integer key (a packed bin or
+// voxel index) to a value, for sparse accumulators filled point by
+// point: keys and values sit in one flat slot array probed linearly, so
+// a lookup of a populated bin is one hash and usually one cache line.
+// The all-ones key marks an empty slot and cannot be stored. The table
+// doubles when it is half full; there is no erase.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_OPENHASHMAP_H
+#define MYPDDPTESTANA_OPENHASHMAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace test {
+
+  template <typename Key, typename Value>
+  class OpenHashMap {
+    static_assert(std::is_unsigned<Key>::value, "OpenHashMap keys are unsigned integers");
+
+  public:
+    static constexpr Key kEmpty = std::numeric_limits<Key>::max();
+
+    explicit OpenHashMap(std::size_t capacity = 64) { Rehash(capacity); }
+
+    std::size_t Size() const { return fSize; }
+    bool Empty() const { return fSize == 0; }
+    void Clear()
+    {
+      std::fill(fSlots.begin(), fSlots.end(), Entry(kEmpty, Value()));
+      fSize = 0;
+    }
+
+    // Value of key, value-initialised on first access
+    Value & operator[](Key key)
+    {
+      std::size_t i = Slot(key);
+      for(;;){
+        Entry & e = fSlots[i];
+        if(e.first == key) return e.second;
+        if(e.first == kEmpty) break;
+        i = (i + 1) & fMask;
+      }
+      if(2 * (fSize + 1) > fSlots.size()){
+        Rehash(2 * fSlots.size());
+        return (*this)[key];
+      }
+      fSize++;
+      fSlots[i] = Entry(key, Value());
+      return fSlots[i].second;
+    }
+
+    Value const * Find(Key key) const
+    {
+      for(std::size_t i = Slot(key); ; i = (i + 1) & fMask){
+        Entry const & e = fSlots[i];
+        if(e.first == key) return &e.second;
+        if(e.first == kEmpty) return nullptr;
+      }
+    }
+
+    // f(key, value) over the entries, in slot (unspecified) order
+    template <typename F>
+    void ForEach(F && f) const
+    {
+      for(Entry const & e : fSlots){
+        if(e.first != kEmpty) f(e.first, e.second);
+      }
+    }
+
+    // The entries ordered by key, for reproducible output
+    std::vector< std::pair<Key, Value> > Sorted() const
+    {
+      std::vector< std::pair<Key, Value> > entries;
+      entries.reserve(fSize);
+      ForEach([&entries](Key key, Value const & value){ entries.emplace_back(key, value); });
+      std::sort(entries.begin(), entries.end(), [](auto const & a, auto const & b){ return a.first < b.first; });
+      return entries;
+    }
+
+  private:
+    using Entry = std::pair<Key, Value>;
+
+    // Fibonacci hashing: the high bits of key * 2^64 / phi
+    std::size_t Slot(Key key) const
+    {
+      return std::size_t((std::uint64_t(key) * 0x9E3779B97F4A7C15ull) >> fShift);
+    }
+
+    void Rehash(std::size_t capacity)
+    {
+      std::size_t n = 2;
+      int bits = 1;
+      while(n < capacity){ n <<= 1; bits++; }
+      std::vector<Entry> old(n, Entry(kEmpty, Value()));
+      old.swap(fSlots);
+      fMask = n - 1;
+      fShift = 64 - bits;
+      fSize = 0;
+      for(Entry const & e : old){
+        if(e.first != kEmpty) (*this)[e.first] = e.second;
+      }
+    }
+
+    std::vector<Entry> fSlots;
+    std::size_t fMask = 0;
+    int fShift = 0;
+    std::size_t fSize = 0;
+  };
+
+}
+
+#endif
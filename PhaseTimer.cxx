@@ -0,0 +1,88 @@
+////////////////////////////////////////////////////////////////////////
+// File:        PhaseTimer.cxx
+////////////////////////////////////////////////////////////////////////
+#include "PhaseTimer.h"
+
+#include <algorithm>
+#include <cmath>
+
+double test::LatencyHistogram::BinLowEdge(int bin)
+{
+  return kMin * std::pow(10., double(bin - 1) / kBinsPerDecade);
+}
+
+void test::LatencyHistogram::Add(double seconds)
+{
+  int bin;
+  if(!(seconds >= kMin)) bin = 0;
+  else{
+    bin = 1 + int(std::floor(std::log10(seconds / kMin) * kBinsPerDecade));
+    if(bin > kNBins - 1) bin = kNBins - 1;
+  }
+  fCounts[bin]++;
+  fCount++;
+  fSum += seconds;
+  if(seconds > fMax) fMax = seconds;
+}
+
+void test::LatencyHistogram::Merge(LatencyHistogram const & other)
+{
+  for(int bin = 0; bin < kNBins; bin++) fCounts[bin] += other.fCounts[bin];
+  fCount += other.fCount;
+  fSum += other.fSum;
+  fMax = std::max(fMax, other.fMax);
+}
+
+double test::LatencyHistogram::Quantile(double q) const
+{
+  if(!fCount) return 0.;
+  double const target = q * fCount;
+  double cumulative = 0.;
+  for(int bin = 0; bin < kNBins; bin++){
+    if(!fCounts[bin]) continue;
+    if(cumulative + fCounts[bin] >= target){
+      if(bin == 0) return kMin;
+      if(bin == kNBins - 1) return fMax;
+      // Interpolate in log space inside the bin, never beyond the largest value seen
+      double const frac = (target - cumulative) / fCounts[bin];
+      double const lo = BinLowEdge(bin);
+      return std::min(fMax, lo * std::pow(10., frac / kBinsPerDecade));
+    }
+    cumulative += fCounts[bin];
+  }
+  return fMax;
+}
+
+
+void test::PhaseTimer::Resize(std::size_t nPhases)
+{
+  fCurrent.assign(nPhases, 0.);
+  fTouched.assign(nPhases, false);
+  fPhases.assign(nPhases, LatencyHistogram());
+}
+
+void test::PhaseTimer::StartEvent()
+{
+  fStart = fLast = Clock::now();
+}
+
+void test::PhaseTimer::EndEvent()
+{
+  Clock::time_point const now = Clock::now();
+  fTotal.Add(std::chrono::duration<double>(now - fStart).count());
+  if(!fEnabled) return;
+  for(std::size_t phase = 0; phase < fPhases.size(); phase++){
+    if(!fTouched[phase]) continue;
+    fPhases[phase].Add(fCurrent[phase]);
+    fCurrent[phase] = 0.;
+    fTouched[phase] = false;
+  }
+}
+
+void test::PhaseTimer::Merge(PhaseTimer const & other)
+{
+  for(std::size_t phase = 0; phase < fPhases.size() && phase < other.fPhases.size(); phase++){
+    fPhases[phase].Merge(other.fPhases[phase]);
+  }
+  fTotal.Merge(other.fTotal);
+}
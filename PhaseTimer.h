@@ -0,0 +1,89 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       PhaseTimer
+// File:        PhaseTimer.h
+//
+// Low-overhead per-event phase timing for MyPDDPTestAna. Each Lap()
+// charges the time since the previous lap to one phase; EndEvent()
+// books the per-event phase totals into log-binned latency histograms
+// from which percentiles are read at the end of the job.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_PHASETIMER_H
+#define MYPDDPTESTANA_PHASETIMER_H
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace test {
+
+  // Latency histogram with logarithmic bins from 100 ns to 1000 s
+  // (kBinsPerDecade bins per decade, ~6% relative resolution).
+  class LatencyHistogram {
+  public:
+    static constexpr int kBinsPerDecade = 40;
+    static constexpr double kMin = 1e-7; // [s]
+    static constexpr int kNDecades = 10;
+    static constexpr int kNBins = kBinsPerDecade * kNDecades + 2; // with under/overflow
+
+    LatencyHistogram() : fCounts(kNBins, 0) {}
+
+    void Add(double seconds);
+    void Merge(LatencyHistogram const & other);
+
+    // Quantile q in [0, 1], interpolated within the log bin [s]
+    double Quantile(double q) const;
+
+    unsigned long Count() const { return fCount; }
+    double Sum() const { return fSum; }
+    double Max() const { return fMax; }
+    double Mean() const { return fCount ? fSum / fCount : 0.; }
+    std::vector<unsigned long> const & Counts() const { return fCounts; }
+    static double BinLowEdge(int bin); // bin in [1, kNBins - 1]
+
+  private:
+    std::vector<unsigned long> fCounts;
+    unsigned long fCount = 0;
+    double fSum = 0.;
+    double fMax = 0.;
+  };
+
+  class PhaseTimer {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit PhaseTimer(std::size_t nPhases = 0) { Resize(nPhases); }
+    void Resize(std::size_t nPhases);
+
+    // Per-phase laps are only taken when enabled; the event total always is.
+    void SetEnabled(bool enabled) { fEnabled = enabled; }
+    bool Enabled() const { return fEnabled; }
+
+    void StartEvent();
+    void Lap(std::size_t phase)
+    {
+      if(!fEnabled) return;
+      Clock::time_point const now = Clock::now();
+      fCurrent[phase] += std::chrono::duration<double>(now - fLast).count();
+      fTouched[phase] = true;
+      fLast = now;
+    }
+    void EndEvent();
+
+    void Merge(PhaseTimer const & other);
+
+    std::size_t NPhases() const { return fPhases.size(); }
+    LatencyHistogram const & Phase(std::size_t phase) const { return fPhases[phase]; }
+    LatencyHistogram const & Total() const { return fTotal; }
+
+  private:
+    bool fEnabled = false;
+    Clock::time_point fStart, fLast;
+    std::vector<double> fCurrent; // this event, per phase [s]
+    std::vector<bool> fTouched;
+    std::vector<LatencyHistogram> fPhases;
+    LatencyHistogram fTotal;
+  };
+
+}
+
+#endif
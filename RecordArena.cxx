@@ -0,0 +1,145 @@
+////////////////////////////////////////////////////////////////////////
+// File:        RecordArena.cxx
+////////////////////////////////////////////////////////////////////////
+#include "RecordArena.h"
+
+#include <algorithm>
+#include <optional>
+
+namespace {
+
+  // Heap resource behind the arena, counting what overflows the buffer
+  class CountingResource : public std::pmr::memory_resource {
+  public:
+    unsigned long allocations = 0;
+    std::size_t bytes = 0;
+
+  private:
+    void * do_allocate(std::size_t n, std::size_t align) override
+    {
+      allocations++;
+      bytes += n;
+      return std::pmr::new_delete_resource()->allocate(n, align);
+    }
+    void do_deallocate(void * p, std::size_t n, std::size_t align) override
+    {
+      std::pmr::new_delete_resource()->deallocate(p, n, align);
+    }
+    bool do_is_equal(std::pmr::memory_resource const & other) const noexcept override
+    {
+      return this == &other;
+    }
+  };
+
+}
+
+struct test::RecordArena::State {
+  std::unique_ptr<std::byte[]> buffer; // not value-initialized
+  std::size_t bufferBytes = 0;
+  CountingResource upstream;
+  std::optional<std::pmr::monotonic_buffer_resource> arena;
+
+  RecordSizes highWater;
+  unsigned long lastAllocations = 0;
+  unsigned long events = 0;
+  unsigned long eventsWithAllocations = 0;
+  unsigned long totalAllocations = 0;
+  unsigned long regrowths = 0;
+
+  void Rebuild()
+  {
+    arena.emplace(buffer.get(), bufferBytes, &upstream);
+  }
+};
+
+void test::RecordSizes::Max(RecordSizes const & other)
+{
+  tracks = std::max(tracks, other.tracks);
+  hits   = std::max(hits, other.hits);
+  calos  = std::max(calos, other.calos);
+  points = std::max(points, other.points);
+}
+
+test::RecordSizes test::RecordSizes::Of(EventRecord const & rec)
+{
+  // Longest column of each size group, as any of them may be disabled
+  RecordSizes sizes;
+#define MYPDDPTESTANA_COLUMN(type, name, bound, group) sizes.bound = std::max(sizes.bound, rec.name.size());
+  MYPDDPTESTANA_RECORD_COLUMNS(MYPDDPTESTANA_COLUMN)
+#undef MYPDDPTESTANA_COLUMN
+#define MYPDDPTESTANA_PLANE_COLUMN(type, name, bound, group) \
+  for(ArenaColumn< type > const & column : rec.Plane##name) sizes.bound = std::max(sizes.bound, column.size());
+  MYPDDPTESTANA_RECORD_PLANE_COLUMNS(MYPDDPTESTANA_PLANE_COLUMN)
+#undef MYPDDPTESTANA_PLANE_COLUMN
+  return sizes;
+}
+
+test::RecordArena::RecordArena(std::size_t initialBytes)
+  : fState(std::make_unique<State>())
+{
+  fState->buffer.reset(new std::byte[initialBytes]);
+  fState->bufferBytes = initialBytes;
+  fState->Rebuild();
+}
+
+test::RecordArena::~RecordArena() = default;
+test::RecordArena::RecordArena(RecordArena &&) = default;
+test::RecordArena & test::RecordArena::operator = (RecordArena &&) = default;
+
+void test::RecordArena::EndEvent(EventRecord const & rec)
+{
+  State & s = *fState;
+  s.highWater.Max(RecordSizes::Of(rec));
+  s.lastAllocations = s.upstream.allocations;
+  s.events++;
+  if(s.lastAllocations) s.eventsWithAllocations++;
+  s.totalAllocations += s.lastAllocations;
+}
+
+void test::RecordArena::BeginEvent(EventRecord & rec)
+{
+  State & s = *fState;
+
+  // The record's buffers all live in the arena (or the heap overflow of
+  // it): forget them before the arena memory goes away
+  rec.Rebind(std::pmr::null_memory_resource());
+  std::size_t const overflow = s.upstream.bytes;
+  s.arena->release();
+  if(overflow){
+    s.arena.reset();
+    // Room for everything the last event needed, plus some slack
+    s.bufferBytes += overflow + overflow / 4;
+    s.buffer.reset(new std::byte[s.bufferBytes]);
+    s.regrowths++;
+  }
+  s.Rebuild();
+  s.upstream.allocations = 0;
+  s.upstream.bytes = 0;
+
+  rec.Rebind(&*s.arena);
+}
+
+void test::RecordArena::Reserve(EventRecord & rec, RecordSizes const & expected, RecordMask const & mask) const
+{
+  RecordSizes n = fState->highWater;
+  n.Max(expected);
+
+  // +1: the offset columns hold one entry more than there are tracks
+#define MYPDDPTESTANA_COLUMN(type, name, size, group) if(mask.Field(kRecord##name)) rec.name.reserve(n.size + 1);
+  MYPDDPTESTANA_RECORD_COLUMNS(MYPDDPTESTANA_COLUMN)
+#undef MYPDDPTESTANA_COLUMN
+#define MYPDDPTESTANA_PLANE_COLUMN(type, name, bound, group) \
+  for(std::size_t plane = 0; plane < rec.Plane##name.size(); plane++){ \
+    if(mask.Plane(kRecordPlane##name, plane)) rec.Plane##name[plane].reserve(n.bound); \
+  }
+  MYPDDPTESTANA_RECORD_PLANE_COLUMNS(MYPDDPTESTANA_PLANE_COLUMN)
+#undef MYPDDPTESTANA_PLANE_COLUMN
+}
+
+unsigned long test::RecordArena::LastEventAllocations() const { return fState->lastAllocations; }
+unsigned long test::RecordArena::Events() const { return fState->events; }
+unsigned long test::RecordArena::EventsWithAllocations() const { return fState->eventsWithAllocations; }
+unsigned long test::RecordArena::TotalAllocations() const { return fState->totalAllocations; }
+unsigned long test::RecordArena::Regrowths() const { return fState->regrowths; }
+std::size_t test::RecordArena::BufferBytes() const { return fState->bufferBytes; }
+test::RecordSizes const & test::RecordArena::HighWater() const { return fState->highWater; }
@@ -0,0 +1,71 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       RecordArena
+// File:        RecordArena.h
+//
+// Per-event arena for the columns of one EventRecord. All columns are
+// carved out of one buffer with a pointer bump; at the start of the next
+// event the whole buffer is released at once. The columns are reserved
+// from the association sizes of the event and from the running
+// high-water mark. When an event overflows the buffer, the overflow is
+// served by (and counted on) the heap and the buffer is regrown to the
+// new high-water mark, so steady state runs with no allocations.
+// The arena must outlive the records bound to it.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_RECORDARENA_H
+#define MYPDDPTESTANA_RECORDARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+#include "EventRecord.h"
+
+namespace test {
+
+  // Expected column lengths of one event
+  struct RecordSizes {
+    std::size_t tracks = 0;  // written tracks
+    std::size_t hits = 0;    // hits of those tracks
+    std::size_t calos = 0;   // calorimetry objects
+    std::size_t points = 0;  // calorimetry points
+
+    void Max(RecordSizes const & other);
+    static RecordSizes Of(EventRecord const & rec);
+  };
+
+  class RecordArena {
+  public:
+    explicit RecordArena(std::size_t initialBytes = std::size_t(1) << 20);
+    ~RecordArena();
+    RecordArena(RecordArena &&);
+    RecordArena & operator = (RecordArena &&);
+
+    // Release the arena, regrow it if the previous event overflowed, and
+    // rebind rec to it with empty columns
+    void BeginEvent(EventRecord & rec);
+
+    // Count the heap allocations of the event and raise the high-water
+    // mark to the sizes of rec
+    void EndEvent(EventRecord const & rec);
+
+    // Reserve the enabled columns of rec for the larger of expected and
+    // the high-water mark of the previous events
+    void Reserve(EventRecord & rec, RecordSizes const & expected, RecordMask const & mask = RecordMask()) const;
+
+    // Heap allocations made for the record during the last ended event
+    unsigned long LastEventAllocations() const;
+    unsigned long Events() const;                // ended events
+    unsigned long EventsWithAllocations() const; // ended events with at least one
+    unsigned long TotalAllocations() const;
+    unsigned long Regrowths() const;             // buffer reallocations between events
+    std::size_t BufferBytes() const;
+    RecordSizes const & HighWater() const;
+
+  private:
+    struct State;
+    std::unique_ptr<State> fState;
+  };
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////
+// File:        ReducedPrecision.cxx
+////////////////////////////////////////////////////////////////////////
+#include "ReducedPrecision.h"
+
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+bool test::PrecisionSpec::ParseMode(std::string const & name, Mode & mode)
+{
+  if(name == "Double")       mode = kDouble;
+  else if(name == "Float")   mode = kFloat;
+  else if(name == "Float16") mode = kFloat16;
+  else if(name == "Fixed")   mode = kFixed;
+  else return false;
+  return true;
+}
+
+std::string test::PrecisionSpec::Validate() const
+{
+  if(mode == kFloat16 && (bits < 1 || bits > 23)) return "Float16 needs 1 <= Bits <= 23";
+  if(mode == kFixed){
+    if(bits < 2 || bits > 32) return "Fixed needs 2 <= Bits <= 32";
+    if(!(max > min)) return "Fixed needs Max > Min";
+  }
+  return "";
+}
+
+std::string test::PrecisionSpec::Describe() const
+{
+  std::ostringstream out;
+  switch(mode){
+  case kDouble:  out << "Double"; break;
+  case kFloat:   out << "Float"; break;
+  case kFloat16: out << "Float16[" << bits << "]"; break;
+  case kFixed:   out << "Fixed[" << min << "," << max << "," << bits << "]"; break;
+  }
+  return out.str();
+}
+
+
+test::ReducedPrecisionColumn::ReducedPrecisionColumn(PrecisionSpec const & spec)
+  : fSpec(spec)
+{
+  if(fSpec.mode == PrecisionSpec::kFixed){
+    fMaxCode = fSpec.bits >= 32 ? 0xFFFFFFFFu : (std::uint32_t(1) << fSpec.bits) - 1;
+    fScale = fMaxCode / (fSpec.max - fSpec.min);
+  }
+}
+
+float test::ReducedPrecisionColumn::TruncateMantissa(double x) const
+{
+  // Round to nearest on the kept mantissa bits, then clear the others
+  float f = x;
+  if(!std::isfinite(f)) return f;
+  std::uint32_t u;
+  std::memcpy(&u, &f, sizeof(u));
+  int const drop = 23 - fSpec.bits;
+  if(drop > 0){
+    u += std::uint32_t(1) << (drop - 1);
+    u &= ~((std::uint32_t(1) << drop) - 1);
+  }
+  std::memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+std::uint32_t test::ReducedPrecisionColumn::Quantize(double x)
+{
+  if(!(x >= fSpec.min)){ fNClipped++; return 0; } // also catches NaN
+  if(x > fSpec.max){ fNClipped++; return fMaxCode; }
+  return std::uint32_t(std::lround((x - fSpec.min) * fScale));
+}
+
+void test::ReducedPrecisionColumn::Encode(std::vector<double> const & values)
+{
+  std::size_t const n = values.size();
+  fNEncoded += n;
+  switch(fSpec.mode){
+  case PrecisionSpec::kDouble:
+    break;
+  case PrecisionSpec::kFloat:
+  case PrecisionSpec::kFloat16:
+    fFloat.resize(n);
+    for(std::size_t i = 0; i < n; i++){
+      float const f = fSpec.mode == PrecisionSpec::kFloat ? float(values[i]) : TruncateMantissa(values[i]);
+      fFloat[i] = f;
+      double const err = std::abs(double(f) - values[i]);
+      if(err > fMaxError) fMaxError = err;
+    }
+    break;
+  case PrecisionSpec::kFixed:
+    if(UsesShort()) fShort.resize(n);
+    else fInt.resize(n);
+    for(std::size_t i = 0; i < n; i++){
+      std::uint32_t const q = Quantize(values[i]);
+      if(UsesShort()) fShort[i] = q;
+      else fInt[i] = q;
+      if(!(values[i] >= fSpec.min && values[i] <= fSpec.max)) continue; // clipped, counted separately
+      double const err = std::abs(DecodeFixed(q) - values[i]);
+      if(err > fMaxError) fMaxError = err;
+    }
+    break;
+  }
+}
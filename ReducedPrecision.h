@@ -0,0 +1,76 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       ReducedPrecisionColumn
+// File:        ReducedPrecision.h
+//
+// Lossy encodings for the double-valued output columns of
+// MyPDDPTestAna: plain float, float with a truncated mantissa (the
+// Float16_t/Double32_t "no range" scheme) and fixed-point quantization
+// over a configured [Min, Max] range (the Double32_t[min,max,nbits]
+// scheme). Keeps track of the largest encoding error on in-range values
+// and of how many values were clipped to the fixed-point range.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_REDUCEDPRECISION_H
+#define MYPDDPTESTANA_REDUCEDPRECISION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace test {
+
+  struct PrecisionSpec {
+    enum Mode { kDouble, kFloat, kFloat16, kFixed };
+
+    Mode mode = kDouble;
+    int bits = 0;            // mantissa bits (kFloat16) or total bits (kFixed)
+    double min = 0., max = 0.; // kFixed range
+
+    // Parses "Double", "Float", "Float16" or "Fixed"; returns false if unknown.
+    static bool ParseMode(std::string const & name, Mode & mode);
+    // Empty if the spec is usable, otherwise a description of the problem.
+    std::string Validate() const;
+    // Short description, also used as branch title suffix, e.g. "Fixed[-400,400,16]".
+    std::string Describe() const;
+  };
+
+  class ReducedPrecisionColumn {
+  public:
+    explicit ReducedPrecisionColumn(PrecisionSpec const & spec);
+
+    // Encode a whole column into the buffer matching the mode.
+    void Encode(std::vector<double> const & values);
+
+    // Value a reader recovers from the stored representation.
+    double DecodeFixed(std::uint32_t q) const { return fSpec.min + q / fScale; }
+
+    PrecisionSpec const & Spec() const { return fSpec; }
+    bool UsesShort() const { return fSpec.mode == PrecisionSpec::kFixed && fSpec.bits <= 16; }
+
+    // Buffers the output branches point at
+    std::vector<float> & FloatBuffer() { return fFloat; }
+    std::vector<std::uint16_t> & ShortBuffer() { return fShort; }
+    std::vector<std::uint32_t> & IntBuffer() { return fInt; }
+
+    double MaxError() const { return fMaxError; }
+    unsigned long NClipped() const { return fNClipped; }
+    unsigned long NEncoded() const { return fNEncoded; }
+
+  private:
+    float TruncateMantissa(double x) const;
+    std::uint32_t Quantize(double x);
+
+    PrecisionSpec fSpec;
+    double fScale = 1.;          // kFixed: steps per unit
+    std::uint32_t fMaxCode = 0;  // kFixed: 2^bits - 1
+    std::vector<float> fFloat;
+    std::vector<std::uint16_t> fShort;
+    std::vector<std::uint32_t> fInt;
+
+    double fMaxError = 0.;
+    unsigned long fNClipped = 0;
+    unsigned long fNEncoded = 0;
+  };
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+////////////////////////////////////////////////////////////////////////
+// File:        StoppingMuonAccumulator.cxx
+////////////////////////////////////////////////////////////////////////
+#include "StoppingMuonAccumulator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+void test::StoppingMuonAccumulator::Configure(StoppingMuonConfig const & config)
+{
+  fConfig = config;
+  fRangeScale = fConfig.nRangeBins / fConfig.rangeMax;
+  fChargeScale = fConfig.nChargeBins / fConfig.qMax;
+  double const keys = double(fConfig.nPlanes) * fConfig.nRangeBins * (fConfig.nChargeBins + 1);
+  if(fConfig.enable && !(keys > 0. && keys < 4294967295.)){
+    throw std::runtime_error("StoppingMuonAccumulator: the plane, residual range and dQ/dx bins must number below 2^32 - 1");
+  }
+  fRowStride = fConfig.nChargeBins + 1;
+  fPlaneStride = fConfig.nRangeBins * fRowStride;
+  fTracks = 0;
+  fCounts.Clear();
+}
+
+bool test::StoppingMuonAccumulator::TagTrack(double const end[3])
+{
+  double const m = fConfig.fiducialMargin;
+  bool const stopping = end[0] > fConfig.xMin + m && end[0] < fConfig.xMax - m
+                     && end[1] > fConfig.yMin + m && end[1] < fConfig.yMax - m
+                     && end[2] > fConfig.zMin + m && end[2] < fConfig.zMax - m;
+  if(stopping) fTracks++;
+  return stopping;
+}
+
+void test::StoppingMuonAccumulator::Merge(StoppingMuonAccumulator const & other)
+{
+  fTracks += other.fTracks;
+  other.fCounts.ForEach([this](std::uint32_t key, unsigned long count){ fCounts[key] += count; });
+}
+
+std::vector<test::StoppingMuonBin> test::StoppingMuonAccumulator::FitBragg() const
+{
+  std::vector<StoppingMuonBin> bins;
+  if(!Enabled()) return bins;
+  auto const entries = fCounts.Sorted(); // (key, count) by key: rows are contiguous
+  int const nRows = std::min(fConfig.nRangeBins, int(std::ceil(fConfig.braggRangeMax * fRangeScale)));
+  double const width = fConfig.qMax / fConfig.nChargeBins;
+  std::vector<unsigned long> row(fRowStride);
+
+  auto entry = entries.begin();
+  for(int plane = 0; plane < fConfig.nPlanes; plane++){
+    for(int ir = 0; ir < nRows; ir++){
+      // Dense charge row from the sparse entries of this (plane, range bin)
+      std::uint32_t const first = Key(plane, ir, 0), last = first + fRowStride;
+      std::fill(row.begin(), row.end(), 0ul);
+      StoppingMuonBin bin{ plane, (ir + 0.5) / fRangeScale, 0, false, 0., 0., 0. };
+      for(; entry != entries.end() && entry->first < first; ++entry);
+      for(; entry != entries.end() && entry->first < last; ++entry){
+        row[entry->first - first] = entry->second;
+        bin.n += entry->second;
+      }
+      bins.push_back(bin);
+      if(bin.n < fConfig.minEntries) continue;
+
+      // Gaussian peak around the mode, overflow excluded: weighted least
+      // squares of ln(count) = a0 + a1 u + a2 u^2 (weight count, its inverse
+      // Poisson variance), u in bins from the mode
+      int const mode = std::max_element(row.begin(), row.end() - 1) - row.begin();
+      int const lo = std::max(0, mode - fConfig.fitHalfWidth);
+      int const hi = std::min(fConfig.nChargeBins - 1, mode + fConfig.fitHalfWidth);
+      double s[5] = { 0., 0., 0., 0., 0. }, t[3] = { 0., 0., 0. };
+      unsigned long nPeak = 0;
+      int nFit = 0;
+      for(int iq = lo; iq <= hi; iq++){
+        if(!row[iq]) continue;
+        double const w = row[iq], u = iq - mode, y = std::log(double(row[iq]));
+        double p = w;
+        for(int k = 0; k < 5; k++){ s[k] += p; if(k < 3) t[k] += p * y; p *= u; }
+        nPeak += row[iq];
+        nFit++;
+      }
+      StoppingMuonBin & result = bins.back();
+      result.mpv = width * (mode + 0.5);
+      if(nFit < 3) continue;
+      // Normal equations by Cramer's rule
+      auto const det3 = [](double a, double b, double c, double d, double e, double f, double g, double h, double i){
+        return a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+      };
+      double const det = det3(s[0], s[1], s[2], s[1], s[2], s[3], s[2], s[3], s[4]);
+      if(det == 0.) continue;
+      double const a1 = det3(s[0], t[0], s[2], s[1], t[1], s[3], s[2], t[2], s[4]) / det;
+      double const a2 = det3(s[0], s[1], t[0], s[1], s[2], t[1], s[2], s[3], t[2]) / det;
+      if(!(a2 < 0.)) continue;
+      double const peak = -a1 / (2. * a2);
+      if(!(peak >= lo - mode && peak <= hi - mode)) continue;
+      result.valid = true;
+      result.mpv = width * (mode + 0.5 + peak);
+      result.width = width * std::sqrt(-1. / (2. * a2));
+      result.mpvError = result.width / std::sqrt(double(nPeak));
+    }
+  }
+  return bins;
+}
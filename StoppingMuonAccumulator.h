@@ -0,0 +1,109 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       StoppingMuonAccumulator
+// File:        StoppingMuonAccumulator.h
+//
+// Streaming dQ/dx versus residual range of the stopping muons, for the
+// energy-scale calibration. A track stops when its end point lies inside
+// the active volume shrunk by a fiducial margin; its calorimetry points
+// are binned per plane in (residual range, dQ/dx). The 2D histogram is
+// sparse, an OpenHashMap from the packed (plane, range, charge) bin to
+// its count, so only populated bins cost memory. At the end of the job
+// the most probable dQ/dx of each residual-range bin of the Bragg region
+// is fitted.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_STOPPINGMUONACCUMULATOR_H
+#define MYPDDPTESTANA_STOPPINGMUONACCUMULATOR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "OpenHashMap.h"
+
+namespace test {
+
+  struct StoppingMuonConfig {
+    bool enable = false;
+    int nPlanes = 2;
+    // Active volume [cm]; the track end must be at least fiducialMargin inside
+    double xMin = -300., xMax = 300.;
+    double yMin = -300., yMax = 300.;
+    double zMin = 0., zMax = 600.;
+    double fiducialMargin = 10.;
+    // Residual-range binning [cm]
+    int nRangeBins = 200;
+    double rangeMax = 200.;
+    // dQ/dx binning [fC/cm], last bin for the overflow
+    int nChargeBins = 200;
+    double qMax = 20.;
+    // Points with a track pitch outside [minPitch, maxPitch] [cm] are skipped
+    double minPitch = 0.3, maxPitch = 3.;
+    // MPV fits: residual ranges up to braggRangeMax [cm], bins with at least
+    // minEntries points, Gaussian peak over +- fitHalfWidth charge bins of the mode
+    double braggRangeMax = 100.;
+    unsigned long minEntries = 50;
+    int fitHalfWidth = 5;
+  };
+
+  struct StoppingMuonBin {
+    int plane;
+    double resRange;       // bin centre [cm]
+    unsigned long n;
+    bool valid;
+    double mpv;            // [fC/cm]
+    double mpvError;
+    double width;          // Gaussian sigma of the peak [fC/cm]
+  };
+
+  class StoppingMuonAccumulator {
+  public:
+    // Throws std::runtime_error when the bins do not fit the 32-bit keys
+    void Configure(StoppingMuonConfig const & config);
+    StoppingMuonConfig const & Config() const { return fConfig; }
+    bool Enabled() const { return fConfig.enable; }
+
+    // Whether a track ending at end stops inside the fiducial volume; counts it if so
+    bool TagTrack(double const end[3]);
+    unsigned long StoppingTracks() const { return fTracks; }
+
+    void Add(int plane, double resRange, double pitch, double dQdx)
+    {
+      if(plane < 0 || plane >= fConfig.nPlanes) return;
+      if(!(resRange >= 0. && resRange < fConfig.rangeMax)) return;
+      if(!(pitch >= fConfig.minPitch && pitch <= fConfig.maxPitch)) return;
+      int const ir = std::min(int(resRange * fRangeScale), fConfig.nRangeBins - 1); // rounding just below rangeMax
+      int iq = dQdx > 0. ? int(dQdx * fChargeScale) : 0;
+      if(iq >= fConfig.nChargeBins) iq = fConfig.nChargeBins; // overflow bin
+      fCounts[Key(plane, ir, iq)]++;
+    }
+
+    void Merge(StoppingMuonAccumulator const & other);
+
+    // Number of populated (plane, residual range, dQ/dx) bins
+    std::size_t PopulatedBins() const { return fCounts.Size(); }
+    // f(plane, range bin, charge bin, count) over the populated bins
+    template <typename F>
+    void ForEachBin(F && f) const
+    {
+      fCounts.ForEach([&](std::uint32_t key, unsigned long count){
+          f(int(key / fPlaneStride), int(key % fPlaneStride / fRowStride), int(key % fRowStride), count);
+        });
+    }
+
+    // MPV fit of each Bragg-region residual-range bin of each plane
+    std::vector<StoppingMuonBin> FitBragg() const;
+
+  private:
+    std::uint32_t Key(int plane, int ir, int iq) const { return plane * fPlaneStride + ir * fRowStride + iq; }
+
+    StoppingMuonConfig fConfig;
+    double fRangeScale = 0.;  // bins per cm
+    double fChargeScale = 0.; // bins per fC/cm
+    std::uint32_t fRowStride = 0, fPlaneStride = 0;
+    unsigned long fTracks = 0;
+    OpenHashMap<std::uint32_t, unsigned long> fCounts; // populated bins
+  };
+
+}
+
+#endif
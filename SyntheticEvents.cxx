@@ -0,0 +1,133 @@
+////////////////////////////////////////////////////////////////////////
+// File:        SyntheticEvents.cxx
+////////////////////////////////////////////////////////////////////////
+#include "SyntheticEvents.h"
+
+#include <algorithm>
+#include <cmath>
+
+std::size_t test::SyntheticEvent::NPoints() const
+{
+  std::size_t n = 0;
+  for(std::vector<float> const & v : dQdx) n += v.size();
+  return n;
+}
+
+
+test::SyntheticEventGenerator::SyntheticEventGenerator(SyntheticConfig const & config)
+  : fConfig(config)
+  , fRandom(config.seed)
+{
+}
+
+void test::SyntheticEventGenerator::Generate(SyntheticEvent & event)
+{
+  std::uniform_real_distribution<double> uniform(0., 1.);
+  std::uniform_int_distribution<int> pdgPick(0, 3);
+  static constexpr int kOtherPdg[4] = { 11, 211, 2212, 22 };
+
+  event = SyntheticEvent();
+  event.eventID = fNextEventID++;
+
+  std::size_t const n = fConfig.nPFParticles;
+  event.pfps.resize(n);
+  event.pfpTracks.resize(n);
+  std::size_t nTracks = 0;
+  for(std::size_t i = 0; i < n; i++){
+    bool const muon = uniform(fRandom) < fConfig.primaryMuonFraction;
+    // Non-muons are a mix of secondaries and primaries of other species
+    event.pfps[i].isPrimary = muon || uniform(fRandom) < 0.5;
+    event.pfps[i].pdg = muon ? (uniform(fRandom) < 0.5 ? 13 : -13) : kOtherPdg[pdgPick(fRandom)];
+    if(!muon) continue;
+    for(std::size_t t = 0; t < fConfig.tracksPerMuon; t++) event.pfpTracks[i].push_back(nTracks++);
+  }
+
+  // Storage first, views last, so the views never point into reallocated memory
+  event.hits.resize(nTracks);
+  event.calos.resize(nTracks);
+  event.tracks.resize(nTracks);
+  for(std::size_t itrk = 0; itrk < nTracks; itrk++) GenerateTrack(event, itrk);
+
+  std::size_t icalo = 0;
+  for(std::size_t itrk = 0; itrk < nTracks; itrk++){
+    for(CaloView & cal : event.calos[itrk]){
+      cal.dQdx = event.dQdx[icalo].data();
+      cal.xyz = event.xyz[icalo].data();
+      cal.tpIndices = event.tpIndices[icalo].data();
+      cal.resRange = event.resRange[icalo].data();
+      cal.pitch = event.pitch[icalo].data();
+      icalo++;
+    }
+    event.tracks[itrk].nHits = event.hits[itrk].size();
+    event.tracks[itrk].hits = Span<HitView>(event.hits[itrk]);
+    event.tracks[itrk].calos = Span<CaloView>(event.calos[itrk]);
+  }
+}
+
+void test::SyntheticEventGenerator::GenerateTrack(SyntheticEvent & event, std::size_t itrk)
+{
+  SyntheticConfig const & cfg = fConfig;
+  std::uniform_real_distribution<double> uniform(0., 1.);
+  std::normal_distribution<double> gauss(0., 1.);
+
+  // Straight track crossing the 6x6x6 m3 volume: drift coordinate x from the anode down
+  double start[3] = { cfg.anodeX - 600. * uniform(fRandom), -300. + 600. * uniform(fRandom), 600. * uniform(fRandom) };
+  double end[3]   = { cfg.anodeX - 600. * uniform(fRandom), -300. + 600. * uniform(fRandom), 600. * uniform(fRandom) };
+  double const length = std::sqrt((end[0] - start[0]) * (end[0] - start[0]) +
+                                  (end[1] - start[1]) * (end[1] - start[1]) +
+                                  (end[2] - start[2]) * (end[2] - start[2]));
+
+  std::size_t const nHits = std::max<std::size_t>(2, std::lround(cfg.hitsPerTrack * (0.5 + uniform(fRandom))));
+  double const t0 = 100. * gauss(fRandom) + 500.; // a few tracks fall below the start tick cut
+  std::vector<HitView> & hits = event.hits[itrk];
+  hits.resize(nHits);
+  for(std::size_t h = 0; h < nHits; h++){
+    double const f = double(h) / (nHits - 1);
+    double const x = start[0] + f * (end[0] - start[0]);
+    hits[h].plane = int(h % cfg.nPlanes);
+    hits[h].peakTime = t0 + (cfg.anodeX - x) / cfg.driftVelocity / cfg.tickPeriod;
+    hits[h].integral = std::max(0., 800. + 120. * gauss(fRandom));
+    hits[h].channel = 960 * hits[h].plane + unsigned(std::lround(f * 959.));
+  }
+
+  for(int plane = 0; plane < cfg.nPlanes; plane++){
+    std::size_t const nPoints = std::lround(cfg.pointsPerHit * nHits / cfg.nPlanes);
+    std::vector<float> dqdx(nPoints);
+    std::vector<double> xyz(3 * nPoints);
+    std::vector<std::size_t> tp(nPoints);
+    // Points evenly spaced from start to end: the residual range runs down to 0 at the end
+    std::vector<float> resRange(nPoints), pitch(nPoints, nPoints > 1 ? length / (nPoints - 1) : length);
+    for(std::size_t i = 0; i < nPoints; i++){
+      // Hits alternate between planes: the nearest hit of this plane along the track
+      tp[i] = std::min(nHits - 1, std::size_t(std::lround(double(i) / std::max<std::size_t>(nPoints, 1) * nHits / cfg.nPlanes)) * cfg.nPlanes + plane);
+      double const f = nPoints > 1 ? double(i) / (nPoints - 1) : 0.;
+      for(int k = 0; k < 3; k++) xyz[3*i + k] = start[k] + f * (end[k] - start[k]);
+      resRange[i] = (1. - f) * length;
+      // Moyal approximation of the Landau shape (exp(-x) ~ chi2(1)), attenuated along the drift
+      double const z = gauss(fRandom);
+      double const moyal = -std::log(std::max(z * z, 1e-300));
+      double const driftTime = (cfg.anodeX - xyz[3*i]) / cfg.driftVelocity;
+      dqdx[i] = (cfg.dQdxMPV + cfg.dQdxWidth * moyal) * std::exp(-driftTime / cfg.lifetime);
+    }
+    CaloView cal;
+    cal.valid = true;
+    cal.plane = plane;
+    cal.n = nPoints;
+    cal.dQdx = nullptr; // set once all storage exists
+    cal.xyz = nullptr;
+    cal.tpIndices = nullptr;
+    cal.resRange = nullptr;
+    cal.pitch = nullptr;
+    event.calos[itrk].push_back(cal);
+    event.dQdx.push_back(std::move(dqdx));
+    event.xyz.push_back(std::move(xyz));
+    event.tpIndices.push_back(std::move(tp));
+    event.resRange.push_back(std::move(resRange));
+    event.pitch.push_back(std::move(pitch));
+  }
+
+  TrackView & trk = event.tracks[itrk];
+  trk.length = length;
+  for(int k = 0; k < 3; k++){ trk.start[k] = start[k]; trk.end[k] = end[k]; }
+  trk.firstValidPoint = 0;
+}
@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       SyntheticEventGenerator
+// File:        SyntheticEvents.h
+//
+// Generates events shaped like the ProtoDUNE-DP reconstruction output
+// (PFParticles, tracks, hits and per-plane calorimetry) for driving
+// AnaCore without art or input files. Multiplicities are configurable;
+// the charge follows a Landau-like (Moyal) distribution attenuated by
+// an electron lifetime along the drift coordinate.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_SYNTHETICEVENTS_H
+#define MYPDDPTESTANA_SYNTHETICEVENTS_H
+
+#include <cstddef>
+#include <random>
+#include <vector>
+
+#include "AnaCore.h"
+
+namespace test {
+
+  struct SyntheticConfig {
+    std::size_t nPFParticles = 200;   // per event
+    double primaryMuonFraction = 0.2; // fraction of PFParticles that are primary muons
+    std::size_t tracksPerMuon = 1;
+    std::size_t hitsPerTrack = 400;   // mean, over all planes
+    int nPlanes = 2;
+    double pointsPerHit = 1.;         // calorimetry points per hit on the plane
+    double dQdxMPV = 160.;            // [ADC/cm] before attenuation
+    double dQdxWidth = 15.;           // [ADC/cm]
+    double lifetime = 3000.;          // [us]
+    double driftVelocity = 0.16;      // [cm/us]
+    double anodeX = 300.;             // drift coordinate of the anode [cm]
+    double tickPeriod = 0.4;          // [us]
+    unsigned int seed = 12345;
+  };
+
+  // Owns all the storage the views point into; not copyable so that the
+  // views stay valid.
+  struct SyntheticEvent {
+    unsigned int eventID = 0;
+    std::vector<PFParticleView> pfps;
+    std::vector< std::vector<std::size_t> > pfpTracks; // track indices of each PFParticle
+    std::vector<TrackView> tracks;
+
+    // Backing storage
+    std::vector< std::vector<HitView> > hits;          // per track
+    std::vector< std::vector<CaloView> > calos;        // per track
+    std::vector< std::vector<float> > dQdx;            // per calorimetry object
+    std::vector< std::vector<double> > xyz;            // per calorimetry object, interleaved
+    std::vector< std::vector<std::size_t> > tpIndices; // per calorimetry object
+    std::vector< std::vector<float> > resRange;        // per calorimetry object
+    std::vector< std::vector<float> > pitch;           // per calorimetry object
+
+    SyntheticEvent() = default;
+    SyntheticEvent(SyntheticEvent const &) = delete;
+    SyntheticEvent & operator = (SyntheticEvent const &) = delete;
+    SyntheticEvent(SyntheticEvent &&) = default;
+    SyntheticEvent & operator = (SyntheticEvent &&) = default;
+
+    std::size_t NPoints() const;
+  };
+
+  class SyntheticEventGenerator {
+  public:
+    explicit SyntheticEventGenerator(SyntheticConfig const & config);
+
+    void Generate(SyntheticEvent & event);
+
+  private:
+    void GenerateTrack(SyntheticEvent & event, std::size_t itrk);
+
+    SyntheticConfig fConfig;
+    std::mt19937_64 fRandom;
+    unsigned int fNextEventID = 1;
+  };
+
+}
+
+#endif
@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////////////////////
+// File:        TrackCharge.cxx
+////////////////////////////////////////////////////////////////////////
+#include "TrackCharge.h"
+
+#include <algorithm>
+#include <cmath>
+
+void test::P2Quantile::Reset(double p)
+{
+  fP = p;
+  fCount = 0;
+  double const increment[5] = { 0., p / 2., p, (1. + p) / 2., 1. };
+  for(int i = 0; i < 5; i++){
+    fHeight[i] = 0.;
+    fPos[i] = i + 1;
+    fIncrement[i] = increment[i];
+  }
+  fDesired[0] = 1.;
+  fDesired[1] = 1. + 2. * p;
+  fDesired[2] = 1. + 4. * p;
+  fDesired[3] = 3. + 2. * p;
+  fDesired[4] = 5.;
+}
+
+void test::P2Quantile::Add(double x)
+{
+  // The first five values are the initial marker heights
+  if(fCount < 5){
+    fHeight[fCount++] = x;
+    if(fCount == 5) std::sort(fHeight, fHeight + 5);
+    return;
+  }
+  fCount++;
+
+  // Cell of x, extending the extreme markers if needed
+  int k;
+  if(x < fHeight[0]){
+    fHeight[0] = x;
+    k = 0;
+  }
+  else if(x >= fHeight[4]){
+    fHeight[4] = x;
+    k = 3;
+  }
+  else{
+    k = 0;
+    while(x >= fHeight[k + 1]) k++;
+  }
+  for(int i = k + 1; i < 5; i++) fPos[i] += 1.;
+  for(int i = 0; i < 5; i++) fDesired[i] += fIncrement[i];
+
+  // Move the middle markers by one rank towards their desired position,
+  // piecewise-parabolic height if it stays ordered, linear otherwise
+  for(int i = 1; i < 4; i++){
+    double const d = fDesired[i] - fPos[i];
+    if(!((d >= 1. && fPos[i + 1] - fPos[i] > 1.) || (d <= -1. && fPos[i - 1] - fPos[i] < -1.))) continue;
+    int const s = d > 0. ? 1 : -1;
+    double const parabolic = fHeight[i] + s / (fPos[i + 1] - fPos[i - 1])
+      * ((fPos[i] - fPos[i - 1] + s) * (fHeight[i + 1] - fHeight[i]) / (fPos[i + 1] - fPos[i])
+         + (fPos[i + 1] - fPos[i] - s) * (fHeight[i] - fHeight[i - 1]) / (fPos[i] - fPos[i - 1]));
+    if(fHeight[i - 1] < parabolic && parabolic < fHeight[i + 1]) fHeight[i] = parabolic;
+    else fHeight[i] += s * (fHeight[i + s] - fHeight[i]) / (fPos[i + s] - fPos[i]);
+    fPos[i] += s;
+  }
+}
+
+double test::P2Quantile::Value() const
+{
+  if(fCount >= 5) return fHeight[2];
+  if(fCount == 0) return 0.;
+  double sorted[5];
+  std::copy(fHeight, fHeight + fCount, sorted);
+  std::sort(sorted, sorted + fCount);
+  double const rank = fP * (fCount - 1);
+  std::size_t const lo = std::size_t(rank);
+  if(lo + 1 >= fCount) return sorted[fCount - 1];
+  return sorted[lo] + (rank - lo) * (sorted[lo + 1] - sorted[lo]);
+}
+
+test::TrackChargeSummary test::SummarizeCharge(std::vector<float> & values, P2Quantile const & p2, TrackChargeConfig const & config)
+{
+  // The quantile comes from p2 alone: values is only collected when the
+  // median or truncated mean are wanted
+  std::size_t const n = values.size();
+  float const quantile = p2.Count() ? p2.Value() : -1.f;
+  if(!n) return { -1.f, -1.f, quantile };
+
+  // Selection instead of a full sort: each nth_element leaves the ranks
+  // below and above its element on either side
+  TrackChargeSummary summary;
+  auto const begin = values.begin();
+  std::size_t const half = n / 2;
+  std::nth_element(begin, begin + half, values.end());
+  summary.median = values[half];
+  if(n % 2 == 0) summary.median = 0.5f * (summary.median + *std::max_element(begin, begin + half));
+
+  // Truncated mean over the [truncLow, truncHigh] quantile range: the value
+  // of rank i holds the interval [i, i+1), partially kept at the edges
+  double const lo = config.truncLow * n, hi = config.truncHigh * n;
+  std::size_t const first = std::size_t(lo), last = std::min(n, std::size_t(std::ceil(hi))); // ranks [first, last) overlap it
+  if(first < half) std::nth_element(begin, begin + first, begin + half);
+  else if(first > half) std::nth_element(begin + half + 1, begin + first, values.end());
+  if(last - 1 > first) std::nth_element(begin + first + 1, begin + last - 1, values.end());
+  double sum = 0., weight = 0.;
+  for(std::size_t i = first; i < last; i++){
+    double const w = std::fmin(i + 1., hi) - std::fmax(double(i), lo);
+    sum += w * values[i];
+    weight += w;
+  }
+  summary.truncatedMean = weight > 0. ? sum / weight : summary.median;
+  summary.quantile = quantile;
+  return summary;
+}
@@ -0,0 +1,58 @@
+////////////////////////////////////////////////////////////////////////
+// File:        TrackCharge.h
+//
+// Track-level dQ/dx summaries of the calorimetry points of one plane:
+// truncated mean and median over the track's points, and the P2
+// estimate of a quantile (R. Jain and I. Chlamtac, Comm. ACM 28 (1985)
+// 1076), which follows the points as they stream in with five markers
+// and no storage.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_TRACKCHARGE_H
+#define MYPDDPTESTANA_TRACKCHARGE_H
+
+#include <cstddef>
+#include <vector>
+
+namespace test {
+
+  struct TrackChargeConfig {
+    // Truncated mean: quantile range kept
+    double truncLow = 0.05, truncHigh = 0.6;
+    // Probability of the P2 quantile
+    double quantile = 0.5;
+  };
+
+  struct TrackChargeSummary {
+    float truncatedMean;  // [fC/cm]
+    float median;         // [fC/cm]
+    float quantile;       // [fC/cm]
+  };
+
+  class P2Quantile {
+  public:
+    explicit P2Quantile(double p = 0.5) { Reset(p); }
+
+    void Reset(double p);
+    void Add(double x);
+
+    std::size_t Count() const { return fCount; }
+    // Marker estimate; exact (interpolated) below 5 values, 0 without any
+    double Value() const;
+
+  private:
+    double fP;
+    std::size_t fCount;
+    double fHeight[5];    // marker heights
+    double fPos[5];       // actual marker positions (1-based ranks)
+    double fDesired[5];   // desired marker positions
+    double fIncrement[5]; // desired position increments per value
+  };
+
+  // Truncated mean and median of values (reordered in place), quantile
+  // from p2 whether or not values was collected; -1 for the statistics
+  // without any value (the quantile: when p2 saw none)
+  TrackChargeSummary SummarizeCharge(std::vector<float> & values, P2Quantile const & p2, TrackChargeConfig const & config);
+
+}
+
+#endif
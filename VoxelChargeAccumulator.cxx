@@ -0,0 +1,28 @@
+////////////////////////////////////////////////////////////////////////
+// File:        VoxelChargeAccumulator.cxx
+////////////////////////////////////////////////////////////////////////
+#include "VoxelChargeAccumulator.h"
+
+#include <stdexcept>
+
+void test::VoxelChargeAccumulator::Configure(VoxelChargeConfig const & config)
+{
+  fConfig = config;
+  if(fConfig.enable){
+    for(int axis = 0; axis < 3; axis++){
+      if(!(fConfig.size[axis] > 0.)) throw std::runtime_error("VoxelChargeAccumulator: voxel sizes must be positive");
+    }
+    if(fConfig.splitPlanes && fConfig.nPlanes > kMaxPlanes){
+      throw std::runtime_error("VoxelChargeAccumulator: at most 8 planes can be split");
+    }
+  }
+  for(int axis = 0; axis < 3; axis++) fScale[axis] = fConfig.size[axis] > 0. ? 1. / fConfig.size[axis] : 0.;
+  fSkipped = 0;
+  fVoxels.Clear();
+}
+
+void test::VoxelChargeAccumulator::Merge(VoxelChargeAccumulator const & other)
+{
+  fSkipped += other.fSkipped;
+  other.fVoxels.ForEach([this](std::uint64_t key, VoxelCharge const & more){ AddRun(key, more); });
+}
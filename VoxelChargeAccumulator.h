@@ -0,0 +1,153 @@
+////////////////////////////////////////////////////////////////////////
+// Class:       VoxelChargeAccumulator
+// File:        VoxelChargeAccumulator.h
+//
+// Sparse 3D map of the dQ/dx of the selected tracks' calorimetry points,
+// for detector-uniformity studies without writing the points out. Space
+// is cut into voxels of a configurable size; each populated voxel (per
+// plane, or all planes together) keeps the count, sum and sum of squares
+// of its points' dQ/dx. The voxels live in an OpenHashMap keyed by the
+// packed (plane, ix, iy, iz) indices, so only the populated ones cost
+// memory. Dumped once at the end of the job.
+//
+// The sums are integers in units of VoxelCharge::kQuantum: each point's
+// dQ/dx is rounded to that step (far below the calorimetric resolution)
+// and clamped to +-kMaxCharge. They then merge exactly, so the map does
+// not depend on which schedule or thread filled which voxel. At the
+// clamp, the sum of squares holds 2^20 points per voxel before
+// overflowing; at MIP charges, about 10^12.
+////////////////////////////////////////////////////////////////////////
+#ifndef MYPDDPTESTANA_VOXELCHARGEACCUMULATOR_H
+#define MYPDDPTESTANA_VOXELCHARGEACCUMULATOR_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "OpenHashMap.h"
+
+namespace test {
+
+  struct VoxelChargeConfig {
+    bool enable = false;
+    int nPlanes = 2;
+    // Separate voxels per plane (points of planes at or above nPlanes are
+    // skipped), or all planes in the same voxels
+    bool splitPlanes = true;
+    // Voxel edges at origin + k * size along each axis [cm]
+    double size[3] = { 5., 5., 5. };
+    double origin[3] = { 0., 0., 0. };
+  };
+
+  struct VoxelCharge {
+    static constexpr double kQuantum = 1. / 1024.; // [fC/cm]
+    static constexpr double kMaxCharge = 4096.;    // [fC/cm]
+
+    unsigned long count = 0;
+    long long sum = 0;           // [kQuantum]
+    unsigned long long sum2 = 0; // [kQuantum^2]
+
+    // dQ/dx in kQuantum units, clamped
+    static long long Quantize(double dQdx)
+    {
+      double const q = std::fmax(-kMaxCharge, std::fmin(kMaxCharge, dQdx));
+      return std::llround(q / kQuantum);
+    }
+    double Sum() const { return sum * kQuantum; }                  // [fC/cm]
+    double Sum2() const { return double(sum2) * kQuantum * kQuantum; } // [(fC/cm)^2]
+  };
+
+  class VoxelChargeAccumulator {
+  public:
+    // Voxel indices along each axis, offset to be non-negative, take
+    // kAxisBits bits of the key; the plane takes the 3 bits above them
+    static constexpr int kAxisBits = 20;
+    static constexpr std::int64_t kAxisOffset = std::int64_t(1) << (kAxisBits - 1);
+    static constexpr int kMaxPlanes = 8;
+
+    // Throws std::runtime_error on a non-positive voxel size or too many planes
+    void Configure(VoxelChargeConfig const & config);
+    VoxelChargeConfig const & Config() const { return fConfig; }
+    bool Enabled() const { return fConfig.enable; }
+
+    // n points of one plane, xyz interleaved. Consecutive points along a
+    // track mostly share a voxel: each run of them is summed first and
+    // costs one map lookup.
+    void AddPoints(int plane, double const * xyz, float const * dQdx, std::size_t n)
+    {
+      VoxelCharge run;
+      std::uint64_t runKey = OpenHashMap<std::uint64_t, VoxelCharge>::kEmpty;
+      for(std::size_t i = 0; i < n; i++){
+        std::uint64_t key;
+        if(!Key(plane, xyz + 3*i, key)){ fSkipped++; continue; }
+        if(key != runKey){
+          if(run.count) AddRun(runKey, run);
+          runKey = key;
+          run = VoxelCharge();
+        }
+        long long const q = VoxelCharge::Quantize(dQdx[i]);
+        run.count++;
+        run.sum += q;
+        run.sum2 += static_cast<unsigned long long>(q * q);
+      }
+      if(run.count) AddRun(runKey, run);
+    }
+
+    void Merge(VoxelChargeAccumulator const & other);
+
+    std::size_t PopulatedVoxels() const { return fVoxels.Size(); }
+    // Points outside the indexable range or of planes without voxels
+    unsigned long SkippedPoints() const { return fSkipped; }
+
+    // f(plane, index[3], voxel) over the populated voxels ordered by key
+    // (plane, then x, y, z), for reproducible output; plane is -1 when
+    // the planes are not split. Voxel ix spans
+    // [origin + ix * size, origin + (ix + 1) * size).
+    template <typename F>
+    void ForEachVoxel(F && f) const
+    {
+      std::uint64_t const mask = (std::uint64_t(1) << kAxisBits) - 1;
+      for(auto const & entry : fVoxels.Sorted()){
+        std::uint64_t const key = entry.first;
+        int const index[3] = { int(std::int64_t((key >> (2 * kAxisBits)) & mask) - kAxisOffset),
+                               int(std::int64_t((key >> kAxisBits) & mask) - kAxisOffset),
+                               int(std::int64_t(key & mask) - kAxisOffset) };
+        f(fConfig.splitPlanes ? int(key >> (3 * kAxisBits)) : -1, index, entry.second);
+      }
+    }
+
+  private:
+    // Packed (plane, ix, iy, iz); false for a point outside the indexable
+    // range (or not finite) or of a plane without voxels
+    bool Key(int plane, double const xyz[3], std::uint64_t & key) const
+    {
+      if(fConfig.splitPlanes){
+        if(plane < 0 || plane >= fConfig.nPlanes) return false;
+        key = std::uint64_t(plane) << (3 * kAxisBits);
+      }
+      else key = 0;
+      for(int axis = 0; axis < 3; axis++){
+        double const u = std::floor((xyz[axis] - fConfig.origin[axis]) * fScale[axis]);
+        if(!(u >= -kAxisOffset && u < kAxisOffset)) return false;
+        key |= std::uint64_t(std::int64_t(u) + kAxisOffset) << ((2 - axis) * kAxisBits);
+      }
+      return true;
+    }
+
+    void AddRun(std::uint64_t key, VoxelCharge const & run)
+    {
+      VoxelCharge & voxel = fVoxels[key];
+      voxel.count += run.count;
+      voxel.sum += run.sum;
+      voxel.sum2 += run.sum2;
+    }
+
+    VoxelChargeConfig fConfig;
+    double fScale[3] = { 0., 0., 0. }; // voxels per cm
+    unsigned long fSkipped = 0;
+    OpenHashMap<std::uint64_t, VoxelCharge> fVoxels; // populated voxels
+  };
+
+}
+
+#endif